@@ -9,9 +9,12 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include <algorithm>
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -20,6 +23,144 @@ using namespace std;
 #define ROOT_PID 1
 #define INSERT_SPLIT -2
 #define LAST_LEAF -3
+#define RESTART -4
+
+// the tree data page: rootPid, treeHeight, TREE_MAGIC, BTREE_FORMAT_VERSION.
+// files of format version 1 have no magic number.
+#define TREE_MAGIC 0x58495442   // "BTIX"
+#define MAGIC_OFFSET 8
+#define VERSION_OFFSET 12
+
+// the node layouts of older format versions. a leaf keeps its next
+// pointer in the last 4 bytes in all of them.
+// version 1 has no node header and ends the key list at the first key 0;
+// version 2 starts with the node header (the key count comes first).
+// both interleave a key with its value.
+// version 3 has the leaf layout of version 4, and its nonleaf nodes keep
+// 126 keys and the child pointers without entry counts.
+#define V1_LEAF_PAIRS 85
+#define V2_HEADER_SIZE 8
+#define V3_NONLEAF_PAIRS 126
+#define OLD_NEXT_OFFSET (PageFile::PAGE_SIZE - sizeof(PageId))
+#define OLD_PAIR_SIZE (sizeof(int) + sizeof(RecordId))
+
+const double BTreeIndex::DEFAULT_FILL_FACTOR = 1.0;
+
+/*
+ * Feeds the entries of a sorted vector to bulkLoad().
+ */
+class VectorEntrySource : public IndexEntrySource {
+ public:
+	VectorEntrySource(const vector<IndexEntry>& e) : entries(e), pos(0) {}
+
+	RC next(IndexEntry& entry)
+	{
+		if (pos >= entries.size()) { return RC_END_OF_TREE; }
+		entry = entries[pos++];
+		return 0;
+	}
+
+ private:
+	const vector<IndexEntry>& entries;
+	size_t pos;
+};
+
+/*
+ * Feeds the entries of an index of an older format version to bulkLoad(),
+ * walking its leaf chain from the leftmost leaf.
+ */
+class LegacyEntrySource : public IndexEntrySource {
+ public:
+	LegacyEntrySource(const PageFile& f, int v, PageId rootPid, int treeHeight)
+		: pf(f), version(v), pid(rootPid), eid(0), rc(0)
+	{
+		// nodes of version 2 and later start with a header; version 1 has none
+		start = (version == 1) ? 0 : V2_HEADER_SIZE;
+
+		// the leftmost leaf is reached through the first child pointers,
+		// which follow the keys in version 3
+		int first = start;
+		if (version == 3) { first += V3_NONLEAF_PAIRS * sizeof(int); }
+		for (int level = 1; level < treeHeight && rc == 0; level++)
+		{
+			if ((rc = pf.read(pid, page)) == 0) { memcpy(&pid, page + first, sizeof(PageId)); }
+		}
+		if (rc == 0) { rc = pf.read(pid, page); }
+	}
+
+	RC next(IndexEntry& entry)
+	{
+		if (rc < 0) { return rc; }
+
+		while (eid >= keyCount())
+		{
+			memcpy(&pid, page + OLD_NEXT_OFFSET, sizeof(PageId));
+			if (pid == 0) { return RC_END_OF_TREE; }
+			if ((rc = pf.read(pid, page)) < 0) { return rc; }
+			eid = 0;
+		}
+
+		if (version == 3)
+		{
+			// the keys, then the RecordIds
+			memcpy(&entry.key, page + start + eid * sizeof(int), sizeof(int));
+			memcpy(&entry.rid, page + start + BTLeafNode::MAX_PAIRS * sizeof(int) + eid * sizeof(RecordId), sizeof(RecordId));
+		}
+		else
+		{
+			char* ptr = page + start + eid * OLD_PAIR_SIZE;
+			memcpy(&entry.key, ptr, sizeof(int));
+			memcpy(&entry.rid, ptr + sizeof(int), sizeof(RecordId));
+		}
+		eid++;
+		return 0;
+	}
+
+ private:
+	int keyCount()
+	{
+		int count = 0, key;
+
+		if (version != 1)
+		{
+			memcpy(&count, page, sizeof(int));
+			return count;
+		}
+
+		while (count < V1_LEAF_PAIRS)
+		{
+			memcpy(&key, page + count * OLD_PAIR_SIZE, sizeof(int));
+			if (key == 0) { break; }
+			count++;
+		}
+		return count;
+	}
+
+	const PageFile& pf;
+	int    version;    // the format version of the index
+	int    start;      // offset of the first pair in a leaf
+	PageId pid;        // the current leaf
+	int    eid;        // the next entry of the current leaf
+	RC     rc;         // the error hit while reading, if any
+	char   page[PageFile::PAGE_SIZE];
+};
+
+static bool entryKeyLess(const IndexEntry& a, const IndexEntry& b)
+{
+	return a.key < b.key;
+}
+
+/*
+ * The number of entries to put in a node of the given capacity
+ * when it is filled to fillFactor. At least minimum entries are used.
+ */
+static int fillCount(int capacity, double fillFactor, int minimum)
+{
+	int n = (int)(capacity * fillFactor);
+	if (n > capacity) { n = capacity; }
+	if (n < minimum) { n = minimum; }
+	return n;
+}
 
 
 /*
@@ -29,7 +170,15 @@ BTreeIndex::BTreeIndex()
 {
     rootPid = INVALID_PID;
     treeHeight = 0;
+    writable = false;
     fill(buffer, buffer + PageFile::PAGE_SIZE, 0);
+    latches = NULL;
+    nextPid = 0;
+}
+
+BTreeIndex::~BTreeIndex()
+{
+	delete latches;
 }
 
 /*
@@ -43,12 +192,17 @@ RC BTreeIndex::open(const string& indexname, char mode)
 {
 	RC rc;
 
-	if (rc = pf.open(indexname, mode) < 0) 
+	if ((rc = pf.open(indexname, mode)) < 0) 
 	{ 
 		rootPid = INVALID_PID;
 		return rc; 
 	}
 
+	writable = (mode == 'w' || mode == 'W');
+
+	// a tree descent touches one page per level at random
+	pf.advise(PageFile::RANDOM);
+
 	if (pf.endPid() == 0)
 	{
 		rootPid = INVALID_PID;
@@ -57,14 +211,27 @@ RC BTreeIndex::open(const string& indexname, char mode)
 		return 0;
 	}
 
-	if (rc = pf.read(TREE_DATA_PID, buffer) < 0)
+	if ((rc = pf.read(TREE_DATA_PID, buffer)) < 0)
 	{
 		rootPid = INVALID_PID;
 		return rc;
 	}
 
+	int magic, version;
 	memcpy(&rootPid, buffer, sizeof(PageId));
 	memcpy(&treeHeight, buffer + sizeof(PageId), sizeof(int));
+	memcpy(&magic, buffer + MAGIC_OFFSET, sizeof(int));
+	memcpy(&version, buffer + VERSION_OFFSET, sizeof(int));
+
+	if (magic != TREE_MAGIC) { version = 1; }
+
+	if (version < 1 || version > BTREE_FORMAT_VERSION)
+	{
+		pf.close();
+		rootPid = INVALID_PID;
+		treeHeight = 0;
+		return RC_INVALID_FILE_FORMAT;
+	}
 
 	if (rootPid < 1 || treeHeight < 0)
 	{
@@ -72,11 +239,71 @@ RC BTreeIndex::open(const string& indexname, char mode)
 		treeHeight = 0;
 		fill(buffer, buffer + PageFile::PAGE_SIZE, 0);
 	}
-
+	else if (version < BTREE_FORMAT_VERSION && treeHeight > 0)
+	{
+		// an index written in an older node format
+		return upgrade(indexname, mode, version);
+	}
 
     return 0;
 }
 
+/*
+ * Rewrite an index of an older format version in the current format and
+ * reopen it. The entries are bulk loaded into a new file. In 'w' mode
+ * the new file replaces the old one; in 'r' and 'm' mode the old file is
+ * left as it is, and the new one is a private copy that is removed as
+ * soon as it is open.
+ * @param indexname[IN] the name of the index file, open in pf
+ * @param mode[IN] the mode to reopen the index in
+ * @param version[IN] the format version of the index file
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::upgrade(const string& indexname, char mode, int version)
+{
+	RC rc = 0;
+	bool replace = (mode == 'w' || mode == 'W');
+	string tmpname = indexname + (replace ? ".upgrade" : ".XXXXXX");
+	BTreeIndex upgraded;
+
+	if (replace) { ::remove(tmpname.c_str()); }
+	else
+	{
+		vector<char> path(tmpname.begin(), tmpname.end());
+		path.push_back(0);
+		int fd = mkstemp(&path[0]);
+		if (fd < 0) { rc = RC_FILE_OPEN_FAILED; }
+		else { ::close(fd); tmpname = &path[0]; }
+	}
+
+	if (rc == 0 && (rc = upgraded.open(tmpname, 'w')) == 0)
+	{
+		LegacyEntrySource source(pf, version, rootPid, treeHeight);
+		rc = upgraded.bulkLoad(source);
+		RC closeRc = upgraded.close();
+		if (rc == 0) { rc = closeRc; }
+	}
+
+	pf.close();
+	rootPid = INVALID_PID;
+	treeHeight = 0;
+	fill(buffer, buffer + PageFile::PAGE_SIZE, 0);
+
+	if (rc == 0 && replace && ::rename(tmpname.c_str(), indexname.c_str()) < 0) { rc = RC_FILE_WRITE_FAILED; }
+	if (rc < 0)
+	{
+		::remove(tmpname.c_str());
+		return rc;
+	}
+
+	if (replace) { return open(indexname, mode); }
+
+	// the open file outlives its name
+	rc = open(tmpname, mode);
+	::remove(tmpname.c_str());
+	return rc;
+}
+
 /*
  * Close the index file.
  * @return error code. 0 if no error
@@ -91,11 +318,40 @@ RC BTreeIndex::close()
     	memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
     }
 
-    if (rc = pf.write(TREE_DATA_PID, buffer) < 0) { return rc; }
+    int magic = TREE_MAGIC;
+    memcpy(buffer + MAGIC_OFFSET, &magic, sizeof(int));
+    memcpy(buffer + VERSION_OFFSET, &BTREE_FORMAT_VERSION, sizeof(int));
+
+    setConcurrent(false);
+
+    // the tree data page can only be updated in 'w' mode
+    if (writable && (rc = pf.write(TREE_DATA_PID, buffer)) < 0)
+    {
+    	pf.close();
+    	return rc;
+    }
 
     return pf.close();
 }
 
+/*
+ * Switch concurrent mode on or off.
+ * @param on[IN] true to switch concurrent mode on
+ */
+void BTreeIndex::setConcurrent(bool on)
+{
+	if (on && latches == NULL)
+	{
+		latches = new LatchTable;
+		nextPid = max(pf.endPid(), (PageId)ROOT_PID);
+	}
+	else if (!on && latches != NULL)
+	{
+		delete latches;
+		latches = NULL;
+	}
+}
+
 /*
  * Insert (key, RecordId) pair to the index.
  * @param key[IN] the key for the value inserted into the index
@@ -104,6 +360,7 @@ RC BTreeIndex::close()
  */
 RC BTreeIndex::insert(int key, const RecordId& rid)
 {
+	if (latches != NULL) { return insertLatched(key, rid); }
 
 	if (treeHeight == 0)
 	{
@@ -117,18 +374,19 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
 
 	int split_key;
 	PageId split_pid;
+	int left_count, right_count;
 
-	return insert_R(key, rid, 1, rootPid, split_key, split_pid);
+	return insert_R(key, rid, 1, rootPid, split_key, split_pid, left_count, right_count);
 }
 
-RC BTreeIndex::insert_R(int key, const RecordId& rid, int current_height, PageId current_pid, int& split_key, PageId& split_pid)
+RC BTreeIndex::insert_R(int key, const RecordId& rid, int current_height, PageId current_pid, int& split_key, PageId& split_pid, int& left_count, int& right_count)
 {
 	RC rc;
 
 	if (current_height == treeHeight)
 	{	
 		BTLeafNode leaf;
-		if (rc = leaf.read(current_pid, pf) < 0) { return rc; }
+		if ((rc = leaf.read(current_pid, pf)) < 0) { return rc; }
 		if (leaf.insert(key, rid) == RC_NODE_FULL)
 		{
 
@@ -140,16 +398,22 @@ RC BTreeIndex::insert_R(int key, const RecordId& rid, int current_height, PageId
 			leaf.setNextNodePtr(split_pid);
 
 
-			if (rc = leaf.write(current_pid, pf) < 0) { return rc; }
-			if (rc = sibling.write(split_pid, pf) < 0) { return rc; }
+			if ((rc = leaf.write(current_pid, pf)) < 0) { return rc; }
+			if ((rc = sibling.write(split_pid, pf)) < 0) { return rc; }
+
+			left_count = leaf.getKeyCount();
+			right_count = sibling.getKeyCount();
 
 			if (current_height == 1)
 			{
 				BTNonLeafNode root;
+				root.setLevel(treeHeight);
 				root.initializeRoot(current_pid, split_key, split_pid);
+				root.setChildCount(0, left_count);
+				root.setChildCount(1, right_count);
 				rootPid = pf.endPid();
 				treeHeight++;
-				if (rc = root.write(rootPid, pf) < 0) { return rc; }
+				if ((rc = root.write(rootPid, pf)) < 0) { return rc; }
 				return 0;
 			}
 			return INSERT_SPLIT;
@@ -162,42 +426,421 @@ RC BTreeIndex::insert_R(int key, const RecordId& rid, int current_height, PageId
 		BTNonLeafNode node;
 		PageId child = INVALID_PID;
 		int eid;
-		if (rc = node.read(current_pid, pf) < 0) { return rc; }
-		if (rc = node.locateChildPtr(key, child, eid) < 0) { return rc; }
+		if ((rc = node.read(current_pid, pf)) < 0) { return rc; }
+		if ((rc = node.locateChildPtr(key, child, eid)) < 0) { return rc; }
 
-		rc = insert_R(key, rid, current_height + 1, child, split_key, split_pid);
+		rc = insert_R(key, rid, current_height + 1, child, split_key, split_pid, left_count, right_count);
+		if (rc < 0 && rc != INSERT_SPLIT) { return rc; }
+
+		// the child gained an entry
+		node.setChildCount(eid, node.getChildCount(eid) + 1);
 
 		if (rc == INSERT_SPLIT)
 		{
-			if (node.insert(split_key, split_pid) == RC_NODE_FULL)
+			// the new node goes right behind the child that split
+			node.setChildCount(eid, left_count);
+			if (node.insert(eid, split_key, split_pid, right_count) == RC_NODE_FULL)
 			{
 				BTNonLeafNode sibling_node;
 				int mid_key;
 
-				node.insertAndSplit(split_key, split_pid, sibling_node, mid_key);
+				node.insertAndSplit(eid, split_key, split_pid, right_count, sibling_node, mid_key);
 
 				split_key = mid_key;
 				split_pid = pf.endPid();
 
-				if (rc = node.write(current_pid, pf) < 0) { return rc; }
-				if (rc = sibling_node.write(split_pid, pf) < 0) { return rc; }
+				if ((rc = node.write(current_pid, pf)) < 0) { return rc; }
+				if ((rc = sibling_node.write(split_pid, pf)) < 0) { return rc; }
+
+				left_count = node.getEntryCount();
+				right_count = sibling_node.getEntryCount();
 
 				if (current_height == 1)
 				{
 					BTNonLeafNode root;
+					root.setLevel(treeHeight);
 					root.initializeRoot(current_pid, split_key, split_pid);
+					root.setChildCount(0, left_count);
+					root.setChildCount(1, right_count);
 					rootPid = pf.endPid();
 					treeHeight++;
-					if(rc = root.write(rootPid,pf) < 0) { return rc; }
+					if ((rc = root.write(rootPid,pf)) < 0) { return rc; }
 					return 0;
 				}
 				return INSERT_SPLIT;
 			}
-			return node.write(current_pid, pf);
+		}
+		return node.write(current_pid, pf);
+	}
+}
+
+/*
+ * A node latched by crabInsert(), and the child it was left through.
+ */
+struct LatchedNode {
+	PageId pid;
+	int    eid;
+};
+
+/*
+ * Release the latches of the first n nodes of the path.
+ */
+static void unlatch(LatchTable& latches, vector<LatchedNode>& path, size_t n)
+{
+	for (size_t i = 0; i < n; i++) { latches[path[i].pid].writeUnlock(); }
+	path.erase(path.begin(), path.begin() + n);
+}
+
+/*
+ * Insert an entry in concurrent mode, trying again while the root
+ * changes under the insert.
+ * @param key[IN] the key of the entry
+ * @param rid[IN] the RecordId of the entry
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::insertLatched(int key, const RecordId& rid)
+{
+	RC rc;
+	while ((rc = crabInsert(key, rid)) == RESTART) {}
+	return rc;
+}
+
+/*
+ * Insert an entry with latch crabbing: every node on the way down is
+ * latched, and the latches above a node that can take one more key
+ * without splitting are released. The nodes still latched at the leaf
+ * are exactly those a split may reach.
+ * @param key[IN] the key of the entry
+ * @param rid[IN] the RecordId of the entry
+ * @return error code. 0 if no error. RESTART if the root changed before
+ *         it was latched.
+ */
+RC BTreeIndex::crabInsert(int key, const RecordId& rid)
+{
+	RC rc;
+	vector<LatchedNode> path;   // the latched nodes, root side first
+
+	unsigned long long top = meta.readLock();
+	PageId pid = rootPid;
+	int height = treeHeight;
+
+	// the first entry makes a root leaf
+	if (height == 0)
+	{
+		meta.writeLock();
+		if (treeHeight != 0)
+		{
+			meta.writeUnlock();
+			return RESTART;
+		}
+
+		BTLeafNode leaf;
+		PageId leafPid = newPage();
+		leaf.insert(key, rid);
+		if ((rc = leaf.write(leafPid, pf)) == 0)
+		{
+			rootPid = leafPid;
+			treeHeight = 1;
+		}
+		meta.writeUnlock();
+		return rc;
+	}
+
+	(*latches)[pid].writeLock();
+	if (!meta.validate(top))
+	{
+		(*latches)[pid].writeUnlock();
+		return RESTART;
+	}
+	LatchedNode root = { pid, 0 };
+	path.push_back(root);
+
+	for (int level = 1; level < height; level++)
+	{
+		BTNonLeafNode node;
+		PageId child;
+		int eid;
+
+		if ((rc = node.read(pid, pf)) < 0)
+		{
+			unlatch(*latches, path, path.size());
+			return rc;
+		}
+		if (node.getKeyCount() < BTNonLeafNode::MAX_PAIRS) { unlatch(*latches, path, path.size() - 1); }
+
+		// the child gains an entry; if it splits, the count is split below
+		node.locateChildPtr(key, child, eid);
+		node.setChildCount(eid, node.getChildCount(eid) + 1);
+		if ((rc = node.write(pid, pf)) < 0)
+		{
+			unlatch(*latches, path, path.size());
+			return rc;
+		}
+
+		(*latches)[child].writeLock();
+		path.back().eid = eid;
+		LatchedNode next = { child, 0 };
+		path.push_back(next);
+		pid = child;
+	}
+
+	BTLeafNode leaf;
+	if ((rc = leaf.read(pid, pf)) < 0)
+	{
+		unlatch(*latches, path, path.size());
+		return rc;
+	}
+	if (leaf.getKeyCount() < BTLeafNode::MAX_PAIRS)
+	{
+		unlatch(*latches, path, path.size() - 1);
+		leaf.insert(key, rid);
+		rc = leaf.write(pid, pf);
+		unlatch(*latches, path, path.size());
+		return rc;
+	}
+
+	// the leaf splits. readers copy a leaf before following its next
+	// pointer, so they see the entries moved to the sibling either in
+	// the leaf or in the sibling, never in both
+	BTLeafNode sibling;
+	int splitKey;
+	PageId splitPid = newPage();
+
+	leaf.insertAndSplit(key, rid, sibling, splitKey);
+	leaf.setNextNodePtr(splitPid);
+	if ((rc = sibling.write(splitPid, pf)) < 0 || (rc = leaf.write(pid, pf)) < 0)
+	{
+		unlatch(*latches, path, path.size());
+		return rc;
+	}
+	int leftCount = leaf.getKeyCount();
+	int rightCount = sibling.getKeyCount();
+
+	// hand the split up the latched nodes; the latches are kept until the
+	// split stops, so that a new root is in place before the old one is
+	// released
+	for (int i = (int)path.size() - 2; i >= 0; i--)
+	{
+		BTNonLeafNode node;
+		int eid = path[i].eid;
+
+		if ((rc = node.read(path[i].pid, pf)) < 0) { break; }
+		node.setChildCount(eid, leftCount);
+		if (node.insert(eid, splitKey, splitPid, rightCount) == 0)
+		{
+			rc = node.write(path[i].pid, pf);
+			unlatch(*latches, path, path.size());
+			return rc;
+		}
+
+		BTNonLeafNode siblingNode;
+		int midKey;
+		PageId siblingPid = newPage();
+
+		node.insertAndSplit(eid, splitKey, splitPid, rightCount, siblingNode, midKey);
+		if ((rc = siblingNode.write(siblingPid, pf)) < 0 || (rc = node.write(path[i].pid, pf)) < 0) { break; }
+
+		splitKey = midKey;
+		splitPid = siblingPid;
+		leftCount = node.getEntryCount();
+		rightCount = siblingNode.getEntryCount();
+	}
+
+	// the split reached the root (a node with room would have released
+	// the latches above it and stopped the split): a new root goes on top
+	if (rc == 0)
+	{
+		BTNonLeafNode newRoot;
+		PageId newRootPid = newPage();
+
+		newRoot.setLevel(height);
+		newRoot.initializeRoot(path[0].pid, splitKey, splitPid);
+		newRoot.setChildCount(0, leftCount);
+		newRoot.setChildCount(1, rightCount);
+		if ((rc = newRoot.write(newRootPid, pf)) == 0)
+		{
+			meta.writeLock();
+			rootPid = newRootPid;
+			treeHeight = height + 1;
+			meta.writeUnlock();
+		}
+	}
+
+	unlatch(*latches, path, path.size());
+	return rc;
+}
+
+/*
+ * @return the PageId of a new node page
+ */
+PageId BTreeIndex::newPage()
+{
+	// concurrent inserts take pages from a shared counter; a page written
+	// past the end of the file moves the end
+	if (latches != NULL) { return nextPid++; }
+	return pf.endPid();
+}
+
+/*
+ * Build the tree bottom-up from a stream of entries in ascending key order.
+ * @param source[IN] the entries, sorted by key
+ * @param fillFactor[IN] the fraction (0, 1] of each node to fill
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkLoad(IndexEntrySource& source, double fillFactor)
+{
+	RC rc;
+	IndexEntry entry;
+	vector<ChildRef> leaves;   // (first key, pid, count) of every leaf
+
+	if (treeHeight != 0) { return RC_INVALID_FILE_FORMAT; }
+
+	int perLeaf = fillCount(BTLeafNode::MAX_PAIRS, fillFactor, 1);
+
+	// leaves go on consecutive pages after the tree data page, so that
+	// a leaf's next pointer is simply its own pid + 1
+	PageId pid = max(pf.endPid(), (PageId)ROOT_PID);
+	BTLeafNode* leaf = NULL;
+	int count = 0;
+	int lastKey = 0;
+
+	while ((rc = source.next(entry)) == 0)
+	{
+		if (leaf != NULL && entry.key < lastKey)
+		{
+			delete leaf;
+			return RC_UNSORTED_INPUT;
+		}
+		lastKey = entry.key;
+
+		// the current leaf is full: link it to the next page and write it
+		if (leaf != NULL && count == perLeaf)
+		{
+			leaves.back().count = count;
+			leaf->setNextNodePtr(pid + 1);
+			rc = leaf->write(pid, pf);
+			delete leaf;
+			leaf = NULL;
+			if (rc < 0) { return rc; }
+			pid++;
+		}
+
+		if (leaf == NULL)
+		{
+			leaf = new BTLeafNode;
+			ChildRef ref = { entry.key, pid, 0 };
+			leaves.push_back(ref);
+			count = 0;
+		}
+
+		// the entries come sorted: add each after the last, which keeps
+		// equal keys in the order of the source
+		if ((rc = leaf->append(entry.key, entry.rid)) < 0)
+		{
+			delete leaf;
+			return rc;
+		}
+		count++;
+	}
+
+	if (rc != RC_END_OF_TREE)
+	{
+		delete leaf;
+		return rc;
+	}
+
+	// empty stream: the index stays empty
+	if (leaf == NULL) { return 0; }
+
+	// the last leaf ends the leaf chain
+	leaves.back().count = count;
+	rc = leaf->write(pid, pf);
+	delete leaf;
+	if (rc < 0) { return rc; }
+
+	rootPid = leaves[0].pid;
+	treeHeight = 1;
+
+	return buildNonLeafLevels(leaves, fillFactor);
+}
+
+/*
+ * Sort the entries by key and build the tree bottom-up from them.
+ * @param entries[IN/OUT] the entries to index; sorted on return
+ * @param fillFactor[IN] the fraction (0, 1] of each node to fill
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkLoad(vector<IndexEntry>& entries, double fillFactor)
+{
+	// load files are often sorted already
+	for (size_t i = 1; i < entries.size(); i++)
+	{
+		if (entries[i].key < entries[i - 1].key)
+		{
+			stable_sort(entries.begin(), entries.end(), entryKeyLess);
+			break;
+		}
+	}
+
+	VectorEntrySource source(entries);
+	return bulkLoad(source, fillFactor);
+}
+
+/*
+ * Build the nonleaf levels above a level of nodes, one level at a time,
+ * until a single root remains.
+ * @param children[IN] the (smallest key, PageId, entry count) of each node
+ *                     of the level below, left to right
+ * @param fillFactor[IN] the fraction of each node to fill
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::buildNonLeafLevels(vector<ChildRef>& children, double fillFactor)
+{
+	RC rc;
+
+	// a nonleaf node holds one more child than it holds keys
+	int perNode = fillCount(BTNonLeafNode::MAX_PAIRS + 1, fillFactor, 2);
+
+	while (children.size() > 1)
+	{
+		vector<ChildRef> parents;
+
+		size_t i = 0;
+		while (i < children.size())
+		{
+			size_t end = min(children.size(), i + perNode);
+
+			// do not leave a lone child for the last node of the level:
+			// take it into this node if there is room, or hand over one
+			if (children.size() - end == 1)
+			{
+				if (end - i < (size_t)BTNonLeafNode::MAX_PAIRS + 1) { end++; }
+				else { end--; }
+			}
+
+			BTNonLeafNode node;
+			node.setLevel(treeHeight);
+			node.initializeRoot(children[i].pid, children[i + 1].key, children[i + 1].pid);
+			node.setChildCount(0, children[i].count);
+			node.setChildCount(1, children[i + 1].count);
+			for (size_t j = i + 2; j < end; j++)
+			{
+				if ((rc = node.insert(node.getKeyCount(), children[j].key, children[j].pid, children[j].count)) < 0) { return rc; }
+			}
+
+			PageId pid = pf.endPid();
+			if ((rc = node.write(pid, pf)) < 0) { return rc; }
+			ChildRef ref = { children[i].key, pid, node.getEntryCount() };
+			parents.push_back(ref);
 
+			i = end;
 		}
+
+		children.swap(parents);
+		treeHeight++;
 	}
 
+	rootPid = children[0].pid;
 	return 0;
 }
 
@@ -221,7 +864,28 @@ RC BTreeIndex::insert_R(int key, const RecordId& rid, int current_height, PageId
  */
 RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
-	if (treeHeight == 0) { return RC_NO_SUCH_RECORD; }
+	if (latches != NULL)
+	{
+		BTLeafNode leaf;
+		int less, eid;
+		RC rc = descend(searchKey, cursor.pid, leaf, less);
+
+		cursor.eid = 0;
+		if (rc == RC_END_OF_TREE) { cursor.pid = 0; return RC_NO_SUCH_RECORD; }
+		if (rc < 0) { return rc; }
+
+		rc = leaf.locate(searchKey, eid);
+		cursor.eid = eid;
+		return rc;
+	}
+
+	if (treeHeight == 0)
+	{
+		// an empty tree: readForward() reports the end right away
+		cursor.pid = 0;
+		cursor.eid = 0;
+		return RC_NO_SUCH_RECORD;
+	}
 
 	return locate_R(searchKey, cursor, 1, rootPid);
 }
@@ -235,7 +899,7 @@ RC BTreeIndex::locate_R(int searchKey, IndexCursor& cursor, int current_height,
 		BTLeafNode leaf;
 		int eid;
 
-		if (rc = leaf.read(current_pid, pf) < 0) { return rc; }
+		if ((rc = leaf.read(current_pid, pf)) < 0) { return rc; }
 
 		rc = leaf.locate(searchKey, eid);
 		cursor.pid = current_pid;
@@ -248,13 +912,97 @@ RC BTreeIndex::locate_R(int searchKey, IndexCursor& cursor, int current_height,
 		int eid;
 		PageId child;
 
-		if (rc = node.read(current_pid, pf) < 0) { return rc; }
-		if (rc = node.locateChildPtr(searchKey, child, eid) < 0) { return rc; }
+		if ((rc = node.read(current_pid, pf)) < 0) { return rc; }
+		if ((rc = node.locateChildPtr(searchKey, child, eid)) < 0) { return rc; }
 
 		return locate_R(searchKey, cursor, current_height + 1, child);
 	}
 }
 
+/*
+ * Find the leaf where searchKey may be, in concurrent mode, and copy it.
+ * @param searchKey[IN] the key to find
+ * @param pid[OUT] the PageId of the leaf
+ * @param leaf[OUT] a copy of the leaf
+ * @param less[OUT] the number of entries in the leaves left of it
+ * @return error code. 0 if no error. RC_END_OF_TREE if the index is empty.
+ */
+RC BTreeIndex::descend(int searchKey, PageId& pid, BTLeafNode& leaf, int& less)
+{
+	RC rc;
+	while ((rc = tryDescend(searchKey, pid, leaf, less)) == RESTART) {}
+	return rc;
+}
+
+/*
+ * One try of descend(). Each node is read without a latch, and its
+ * version is checked before the child pointer read from it is trusted
+ * and again once the child's version is known, so that the descent
+ * never steps from a node that changed meanwhile.
+ * @return RESTART if a node changed while it was read
+ */
+RC BTreeIndex::tryDescend(int searchKey, PageId& pid, BTLeafNode& leaf, int& less)
+{
+	RC rc;
+
+	unsigned long long top = meta.readLock();
+	int height = treeHeight;
+	pid = rootPid;
+	less = 0;
+	if (height == 0) { return meta.validate(top) ? RC_END_OF_TREE : RESTART; }
+
+	OptLatch* latch = &(*latches)[pid];
+	unsigned long long version = latch->readLock();
+	if (!meta.validate(top)) { return RESTART; }
+
+	for (int level = 1; level < height; level++)
+	{
+		BTNonLeafNode node;
+		PageId child;
+		int eid;
+
+		if ((rc = node.read(pid, pf)) < 0) { return latch->validate(version) ? rc : RESTART; }
+		node.locateChildPtr(searchKey, child, eid);
+		for (int i = 0; i < eid; i++) { less += node.getChildCount(i); }
+		if (!latch->validate(version)) { return RESTART; }
+
+		OptLatch* childLatch = &(*latches)[child];
+		unsigned long long childVersion = childLatch->readLock();
+		if (!latch->validate(version)) { return RESTART; }
+
+		latch = childLatch;
+		version = childVersion;
+		pid = child;
+	}
+
+	rc = leaf.read(pid, pf);
+	leaf.detach();
+	if (!latch->validate(version)) { return RESTART; }
+	return rc;
+}
+
+/*
+ * Read a leaf; in concurrent mode, copy it once no writer holds it.
+ * @param pid[IN] the PageId of the leaf
+ * @param leaf[OUT] the leaf
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::readLeaf(PageId pid, BTLeafNode& leaf)
+{
+	RC rc;
+
+	if (latches == NULL) { return leaf.read(pid, pf); }
+
+	OptLatch& latch = (*latches)[pid];
+	for (;;)
+	{
+		unsigned long long version = latch.readLock();
+		rc = leaf.read(pid, pf);
+		leaf.detach();
+		if (latch.validate(version)) { return rc; }
+	}
+}
+
 /*
  * Read the (key, rid) pair at the location specified by the index cursor,
  * and move foward the cursor to the next entry.
@@ -269,13 +1017,31 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 
 	BTLeafNode leaf;
 	if (cursor.pid == 0) { return LAST_LEAF; }
-	if (rc = leaf.read(cursor.pid, pf) < 0) { return rc; }
-	if (rc = leaf.readEntry(cursor.eid, key, rid) < 0) { return rc; }
+	if ((rc = readLeaf(cursor.pid, leaf)) < 0) { return rc; }
+
+	// locate() leaves the cursor behind the last entry of a leaf when
+	// searchKey is larger than every key in it; continue in the next leaf
+	while (cursor.eid >= leaf.getKeyCount())
+	{
+		cursor.eid = 0;
+		cursor.pid = leaf.getNextNodePtr();
+		if (cursor.pid == 0) { return LAST_LEAF; }
+		if ((rc = readLeaf(cursor.pid, leaf)) < 0) { return rc; }
+	}
+
+	if ((rc = leaf.readEntry(cursor.eid, key, rid)) < 0) { return rc; }
 
 	if (cursor.eid + 1 == leaf.getKeyCount())
 	{
+		PageId current = cursor.pid;
 		cursor.eid = 0;
 		cursor.pid = leaf.getNextNodePtr();
+
+		// leaves stored next to each other are fetched in runs
+		if (cursor.pid == current + 1 && cursor.pid % PageFile::MAX_RANGE == 0)
+		{
+			pf.prefetch(cursor.pid, PageFile::MAX_RANGE);
+		}
 		return 0;
 	}
 
@@ -283,6 +1049,347 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
     return 0;
 }
 
+/*
+ * Position an iterator at the first entry whose key is not smaller than
+ * searchKey.
+ * @param searchKey[IN] the key to find
+ * @param it[OUT] the iterator to position
+ * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if not.
+ *         Otherwise an error code.
+ */
+RC BTreeIndex::seek(int searchKey, Iterator& it)
+{
+	RC rc, found;
+	IndexCursor cursor;
+
+	it.tree = this;
+	it.hi = INT_MAX;
+	it.done = true;
+
+	// the leaf found is copied at once: it may split before a second read
+	if (latches != NULL)
+	{
+		int less;
+		found = descend(searchKey, it.pid, it.leaf, less);
+		if (found == RC_END_OF_TREE) { return RC_NO_SUCH_RECORD; }
+		if (found < 0) { return found; }
+
+		found = it.leaf.locate(searchKey, it.eid);
+		it.count = it.leaf.getKeyCount();
+		it.done = false;
+		return found;
+	}
+
+	found = locate(searchKey, cursor);
+	if (found != 0 && found != RC_NO_SUCH_RECORD) { return found; }
+	if (cursor.pid == 0) { return found; }
+
+	if ((rc = it.leaf.read(cursor.pid, pf)) < 0) { return rc; }
+	it.pid = cursor.pid;
+	it.eid = cursor.eid;
+	it.count = it.leaf.getKeyCount();
+	it.done = false;
+
+	return found;
+}
+
+/*
+ * Position an iterator for a scan of the keys in [lo, hi].
+ * @param lo[IN] the smallest key to return
+ * @param hi[IN] the largest key to return
+ * @param it[OUT] the iterator to position
+ * @return 0 if lo is found. RC_NO_SUCH_RECORD if not.
+ *         Otherwise an error code.
+ */
+RC BTreeIndex::seekRange(int lo, int hi, Iterator& it)
+{
+	RC rc = seek(lo, it);
+	it.hi = hi;
+	if (lo > hi) { it.done = true; }
+	return rc;
+}
+
+/*
+ * Count the entries whose key is smaller than searchKey.
+ * @param searchKey[IN] the key to count up to
+ * @param count[OUT] the number of entries with a smaller key
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::countLess(int searchKey, int& count)
+{
+	RC rc;
+	PageId pid = rootPid;
+	int eid;
+
+	count = 0;
+
+	if (latches != NULL)
+	{
+		BTLeafNode leaf;
+		rc = descend(searchKey, pid, leaf, count);
+		if (rc == RC_END_OF_TREE) { return 0; }
+		if (rc < 0) { return rc; }
+
+		leaf.locate(searchKey, eid);
+		count += eid;
+		return 0;
+	}
+
+	if (treeHeight == 0) { return 0; }
+
+	// every child left of the one descended into holds only smaller keys
+	for (int level = 1; level < treeHeight; level++)
+	{
+		BTNonLeafNode node;
+		if ((rc = node.read(pid, pf)) < 0) { return rc; }
+		node.locateChildPtr(searchKey, pid, eid);
+		for (int i = 0; i < eid; i++) { count += node.getChildCount(i); }
+	}
+
+	BTLeafNode leaf;
+	if ((rc = leaf.read(pid, pf)) < 0) { return rc; }
+	leaf.locate(searchKey, eid);
+	count += eid;
+
+	return 0;
+}
+
+/*
+ * Count the entries whose key is not larger than key.
+ * @param key[IN] the largest key to count
+ * @param count[OUT] the number of entries
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::countAtMost(int key, int& count)
+{
+	RC rc;
+
+	if (key != INT_MAX) { return countLess(key + 1, count); }
+
+	// every entry: the entries left of the last leaf and those in it
+	if (latches != NULL)
+	{
+		BTLeafNode leaf;
+		PageId pid;
+		if ((rc = descend(INT_MAX, pid, leaf, count)) < 0)
+		{
+			count = 0;
+			return (rc == RC_END_OF_TREE) ? 0 : rc;
+		}
+		count += leaf.getKeyCount();
+		return 0;
+	}
+
+	// every entry: the counts of the root's children
+	count = 0;
+	if (treeHeight == 0) { return 0; }
+	if (treeHeight == 1)
+	{
+		BTLeafNode leaf;
+		if ((rc = leaf.read(rootPid, pf)) < 0) { return rc; }
+		count = leaf.getKeyCount();
+		return 0;
+	}
+
+	BTNonLeafNode root;
+	if ((rc = root.read(rootPid, pf)) < 0) { return rc; }
+	count = root.getEntryCount();
+	return 0;
+}
+
+/*
+ * Count the entries whose key is in [lo, hi] and is none of the
+ * excluded keys.
+ * @param lo[IN] the smallest key to count
+ * @param hi[IN] the largest key to count
+ * @param excluded[IN] keys not to count, sorted
+ * @param count[OUT] the number of entries
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::countRange(int lo, int hi, const vector<int>& excluded, int& count)
+{
+	RC rc;
+	int below, upto;
+
+	count = 0;
+	if (lo > hi) { return 0; }
+
+	if ((rc = countLess(lo, below)) < 0) { return rc; }
+	if ((rc = countAtMost(hi, upto)) < 0) { return rc; }
+	count = upto - below;
+
+	for (size_t i = 0; i < excluded.size(); i++)
+	{
+		if (excluded[i] < lo || excluded[i] > hi) { continue; }
+		if ((rc = countLess(excluded[i], below)) < 0) { return rc; }
+		if ((rc = countAtMost(excluded[i], upto)) < 0) { return rc; }
+		count -= upto - below;
+	}
+
+	return 0;
+}
+
+/*
+ * Split the key range [lo, hi] into at most k sub-ranges.
+ * @param lo[IN] the smallest key of the range
+ * @param hi[IN] the largest key of the range
+ * @param k[IN] the number of sub-ranges wanted
+ * @param bounds[OUT] the first key of each sub-range, ascending
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::partition(int lo, int hi, int k, vector<int>& bounds)
+{
+	RC rc;
+	vector<int> cuts;   // the separator keys in (lo, hi]
+	BTNonLeafNode root;
+	PageId pid;
+	int first, last;
+
+	bounds.clear();
+	bounds.push_back(lo);
+	if (k <= 1 || treeHeight <= 1 || lo >= hi) { return 0; }
+
+	if ((rc = root.read(rootPid, pf)) < 0) { return rc; }
+	root.locateChildPtr(lo, pid, first);
+	root.locateChildPtr(hi, pid, last);
+
+	for (int i = first; i < last; i++)
+	{
+		if (root.getKey(i) > lo) { cuts.push_back(root.getKey(i)); }
+	}
+
+	// too few cuts at the root to pick evenly spaced ones: add those of
+	// the children in the range, which are spread over it about as
+	// evenly as the leaves are
+	if ((int)cuts.size() < 2 * k && treeHeight > 2)
+	{
+		for (int i = first; i <= last; i++)
+		{
+			BTNonLeafNode node;
+			if ((rc = node.read(root.getChildPtr(i), pf)) < 0) { return rc; }
+			for (int j = 0; j < node.getKeyCount(); j++)
+			{
+				if (node.getKey(j) > lo && node.getKey(j) <= hi) { cuts.push_back(node.getKey(j)); }
+			}
+		}
+	}
+
+	// (in concurrent mode the nodes may change while they are read)
+	sort(cuts.begin(), cuts.end());
+	cuts.erase(unique(cuts.begin(), cuts.end()), cuts.end());
+
+	// k - 1 cuts evenly spaced among the candidates, without repeats
+	for (int j = 1; j < k && !cuts.empty(); j++)
+	{
+		int key = cuts[(size_t)j * cuts.size() / k];
+		if (key > bounds.back()) { bounds.push_back(key); }
+	}
+
+	return 0;
+}
+
+RC BTreeIndex::Iterator::advance()
+{
+	RC rc;
+
+	while (eid >= count)
+	{
+		PageId current = pid;
+
+		pid = leaf.getNextNodePtr();
+		if (pid == 0)
+		{
+			done = true;
+			return RC_END_OF_TREE;
+		}
+
+		// leaves stored next to each other are fetched in runs
+		if (pid == current + 1 && pid % PageFile::MAX_RANGE == 0)
+		{
+			tree->pf.prefetch(pid, PageFile::MAX_RANGE);
+		}
+
+		if ((rc = tree->readLeaf(pid, leaf)) < 0)
+		{
+			done = true;
+			return rc;
+		}
+		eid = 0;
+		count = leaf.getKeyCount();
+	}
+
+	return 0;
+}
+
+/*
+ * Return the entry at the iterator and move to the next one.
+ * @param key[OUT] the key of the entry
+ * @param rid[OUT] the RecordId of the entry
+ * @return 0 if no error. RC_END_OF_TREE at the end of the tree.
+ */
+RC BTreeIndex::Iterator::next(int& key, RecordId& rid)
+{
+	RC rc;
+
+	if (done) { return RC_END_OF_TREE; }
+	if ((rc = advance()) < 0) { return rc; }
+
+	if ((rc = leaf.readEntry(eid, key, rid)) < 0) { return rc; }
+	if (key > hi)
+	{
+		done = true;
+		return RC_END_OF_TREE;
+	}
+
+	eid++;
+	return 0;
+}
+
+/*
+ * Unpin the current leaf and end the iteration.
+ */
+void BTreeIndex::Iterator::release()
+{
+	leaf.detach();
+	done = true;
+}
+
+/*
+ * Return up to n entries starting at the iterator and move past them.
+ * @param entries[OUT] the entries returned
+ * @param n[IN] the maximum number of entries to return
+ * @return the number of entries returned, 0 at the end of the tree,
+ *         or an error code
+ */
+int BTreeIndex::Iterator::next(IndexEntry* entries, int n)
+{
+	RC rc;
+	int filled = 0;
+
+	while (filled < n && !done)
+	{
+		if ((rc = advance()) < 0)
+		{
+			if (rc != RC_END_OF_TREE) { return rc; }
+			break;
+		}
+
+		// copy as much of the current leaf as fits, up to the last key <= hi
+		int end = min(count, eid + (n - filled));
+		for (; eid < end; eid++, filled++)
+		{
+			leaf.readEntry(eid, entries[filled].key, entries[filled].rid);
+			if (entries[filled].key > hi)
+			{
+				done = true;
+				break;
+			}
+		}
+	}
+
+	return filled;
+}
+
 void BTreeIndex::dump()
 {
 	cout << "Tree Height: " << treeHeight << endl;
@@ -10,9 +10,15 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
+#include <atomic>
+#include <climits>
+#include <utility>
+#include <vector>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
+#include "Latch.h"
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -27,21 +33,114 @@ typedef struct {
   int     eid;  
 } IndexCursor;
 
+/**
+ * A (key, RecordId) pair stored in a b+tree leaf node.
+ */
+typedef struct {
+  int      key;
+  RecordId rid;
+} IndexEntry;
+
+/**
+ * A stream of index entries in ascending key order, consumed by
+ * BTreeIndex::bulkLoad().
+ */
+class IndexEntrySource {
+ public:
+  virtual ~IndexEntrySource() {}
+
+  /**
+   * Produce the next entry of the stream.
+   * @param entry[OUT] the next entry
+   * @return 0 if an entry was produced, RC_END_OF_TREE at the end of
+   *         the stream, or another error code
+   */
+  virtual RC next(IndexEntry& entry) = 0;
+};
+
 /**
  * Implements a B-Tree index for bruinbase.
- * 
+ *
+ * In concurrent mode (see setConcurrent()) several threads may insert
+ * and look up entries at once. Every node page has an OptLatch. Lookups
+ * take no latch: they read each node, check that its version did not
+ * change, and restart from the root if it did. An insert latches the
+ * nodes on its way down. It releases the latches above a node that has
+ * room for one more key, because a split cannot reach past that node.
+ * Iterators copy each leaf and then follow its next pointer, as in a
+ * B-link tree. A leaf split behind them moves entries to the right, and
+ * the next pointer leads to them, so no entry is skipped or returned
+ * twice.
  */
 class BTreeIndex {
  public:
+  // nodes built by bulkLoad() are packed full unless asked otherwise
+  static const double DEFAULT_FILL_FACTOR;
+
+  /**
+   * Walks the leaf entries in key order. The current leaf stays pinned,
+   * so entries are returned straight from its page and the next leaf is
+   * only read at a leaf boundary. An Iterator is positioned by seek()
+   * and must not outlive its index.
+   */
+  class Iterator {
+   public:
+    Iterator() : tree(NULL), pid(0), eid(0), count(0), hi(INT_MAX), done(true) {}
+
+    /**
+     * Return the entry at the iterator and move to the next one.
+     * @param key[OUT] the key of the entry
+     * @param rid[OUT] the RecordId of the entry
+     * @return 0 if no error. RC_END_OF_TREE if every entry was returned.
+     */
+    RC next(int& key, RecordId& rid);
+
+    /**
+     * Return up to n entries starting at the iterator and move past them.
+     * @param entries[OUT] array of at least n entries to fill
+     * @param n[IN] the maximum number of entries to return
+     * @return the number of entries returned, 0 at the end of the tree,
+     *         or an error code
+     */
+    int next(IndexEntry* entries, int n);
+
+    /**
+     * Unpin the current leaf and end the iteration. An iterator must be
+     * released before its index is closed.
+     */
+    void release();
+
+   private:
+    friend class BTreeIndex;
+
+    /**
+     * Move on to the next nonempty leaf if the current one is used up.
+     * @return 0 if no error. RC_END_OF_TREE after the last leaf.
+     */
+    RC advance();
+
+    BTreeIndex* tree;   // the index walked
+    BTLeafNode  leaf;   // the current leaf, pinned
+    PageId      pid;    // the PageId of the current leaf
+    int         eid;    // the next entry of the current leaf
+    int         count;  // the number of entries in the current leaf
+    int         hi;     // the iterator ends before the first key > hi
+    bool        done;   // true once every entry was returned
+  };
+
   BTreeIndex();
+  ~BTreeIndex();
 
   void dump();
 
   /**
    * Open the index file in read or write mode.
    * Under 'w' mode, the index file should be created if it does not exist.
+   * Under 'm' mode, the index file is memory-mapped for reading.
+   * An index file of an older node format is upgraded on a 'w' open; in
+   * 'r' and 'm' mode it is left as it is and a converted copy is read.
    * @param indexname[IN] the name of the index file
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for memory-mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& indexname, char mode);
@@ -51,6 +150,21 @@ class BTreeIndex {
    * @return error code. 0 if no error
    */
   RC close();
+
+  /**
+   * Switch concurrent mode on or off (see BTreeIndex). In concurrent mode
+   * insert(), locate(), seek(), seekRange(), countLess(), countRange()
+   * and the Iterator may be called from several threads at once.
+   * bulkLoad(), partition(), dump() and close() must not run alongside
+   * them. The index is back in single-threaded mode after close().
+   * @param on[IN] true to switch concurrent mode on
+   */
+  void setConcurrent(bool on);
+
+  /**
+   * @return true if the index is in concurrent mode
+   */
+  bool concurrent() const { return latches != NULL; }
     
   /**
    * Insert (key, RecordId) pair to the index.
@@ -59,7 +173,39 @@ class BTreeIndex {
    * @return error code. 0 if no error
    */
   RC insert(int key, const RecordId& rid);
-  RC insert_R(int key, const RecordId& rid, int current_height, PageId current_pid, int& split_key, PageId& split_pid);
+  RC insert_R(int key, const RecordId& rid, int current_height, PageId current_pid, int& split_key, PageId& split_pid, int& left_count, int& right_count);
+
+  /**
+   * Build the tree bottom-up from a stream of entries in ascending key
+   * order. Leaves are packed left to right, fillFactor full, on
+   * consecutive pages; the nonleaf levels are built on top of them.
+   * The index must be empty.
+   * @param source[IN] the entries, sorted by key
+   * @param fillFactor[IN] the fraction (0, 1] of each node to fill
+   * @return error code. 0 if no error. RC_UNSORTED_INPUT if the source
+   *         produced a key smaller than the previous one.
+   */
+  RC bulkLoad(IndexEntrySource& source, double fillFactor = DEFAULT_FILL_FACTOR);
+
+  /**
+   * Sort the entries by key (keeping the order of equal keys) and
+   * build the tree bottom-up from them. The index must be empty.
+   * @param entries[IN/OUT] the entries to index; sorted on return
+   * @param fillFactor[IN] the fraction (0, 1] of each node to fill
+   * @return error code. 0 if no error
+   */
+  RC bulkLoad(std::vector<IndexEntry>& entries, double fillFactor = DEFAULT_FILL_FACTOR);
+
+  /**
+   * @return true if the index holds no entries
+   */
+  bool empty() const { return treeHeight == 0; }
+
+  /**
+   * @return the height of the tree: the number of nodes on a path from
+   *         the root to a leaf, 0 if the index is empty
+   */
+  int height() const { return treeHeight; }
 
   /**
    * Run the standard B+Tree key search algorithm and identify the
@@ -91,18 +237,161 @@ class BTreeIndex {
    * @return error code. 0 if no error
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Position an iterator at the first entry whose key is not smaller than
+   * searchKey (see locate()).
+   * @param searchKey[IN] the key to find
+   * @param it[OUT] the iterator to position
+   * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if it is not;
+   *         the iterator is still positioned. Otherwise an error code.
+   */
+  RC seek(int searchKey, Iterator& it);
+
+  /**
+   * Position an iterator for a scan of the keys in [lo, hi]: it starts
+   * at the first key not smaller than lo and ends before the first key
+   * larger than hi.
+   * @param lo[IN] the smallest key to return
+   * @param hi[IN] the largest key to return
+   * @param it[OUT] the iterator to position
+   * @return 0 if lo is found. RC_NO_SUCH_RECORD if it is not;
+   *         the iterator is still positioned. Otherwise an error code.
+   */
+  RC seekRange(int lo, int hi, Iterator& it);
+
+  /**
+   * Count the entries whose key is smaller than searchKey. Every nonleaf
+   * node keeps the number of entries under each of its children, so only
+   * one root-to-leaf path is read.
+   * @param searchKey[IN] the key to count up to
+   * @param count[OUT] the number of entries with a smaller key
+   * @return error code. 0 if no error
+   */
+  RC countLess(int searchKey, int& count);
+
+  /**
+   * Count the entries whose key is in [lo, hi] and is none of the
+   * excluded keys, without visiting the leaves in between.
+   * @param lo[IN] the smallest key to count
+   * @param hi[IN] the largest key to count
+   * @param excluded[IN] keys not to count, sorted
+   * @param count[OUT] the number of entries
+   * @return error code. 0 if no error
+   */
+  RC countRange(int lo, int hi, const std::vector<int>& excluded, int& count);
+
+  /**
+   * Split the key range [lo, hi] into at most k sub-ranges of about the
+   * same number of entries, for scans of the sub-ranges side by side.
+   * The cuts are separator keys of the root or, when the root has too
+   * few of them inside the range, of the level below it.
+   * @param lo[IN] the smallest key of the range
+   * @param hi[IN] the largest key of the range
+   * @param k[IN] the number of sub-ranges wanted
+   * @param bounds[OUT] the first key of each sub-range, ascending;
+   *                    bounds[0] is lo. Sub-range i ends right before
+   *                    bounds[i + 1], the last one at hi.
+   * @return error code. 0 if no error
+   */
+  RC partition(int lo, int hi, int k, std::vector<int>& bounds);
   
  private:
+  // a node of the level below, as seen by buildNonLeafLevels()
+  struct ChildRef {
+    int    key;    // the smallest key under the node
+    PageId pid;    // the PageId of the node
+    int    count;  // the number of entries under the node
+  };
+
+  /**
+   * Rewrite an index file of an older node format in the current format
+   * and reopen it. Only a 'w' open replaces the file.
+   * @param indexname[IN] the name of the index file, open in pf
+   * @param mode[IN] the mode to reopen the index in
+   * @param version[IN] the format version of the index file
+   * @return error code. 0 if no error
+   */
+  RC upgrade(const std::string& indexname, char mode, int version);
+
+  /**
+   * Insert an entry in concurrent mode, with latch crabbing.
+   * @param key[IN] the key of the entry
+   * @param rid[IN] the RecordId of the entry
+   * @return error code. 0 if no error
+   */
+  RC insertLatched(int key, const RecordId& rid);
+
+  /**
+   * One try of insertLatched().
+   * @return RESTART if the root changed before it was latched
+   */
+  RC crabInsert(int key, const RecordId& rid);
+
+  /**
+   * Find the leaf where searchKey may be, in concurrent mode, and copy it.
+   * Also count the entries left of the leaf.
+   * @param searchKey[IN] the key to find
+   * @param pid[OUT] the PageId of the leaf
+   * @param leaf[OUT] a copy of the leaf (see BTLeafNode::detach())
+   * @param less[OUT] the number of entries in the leaves left of it
+   * @return error code. 0 if no error. RC_END_OF_TREE if the index is
+   *         empty.
+   */
+  RC descend(int searchKey, PageId& pid, BTLeafNode& leaf, int& less);
+
+  /**
+   * One try of descend().
+   * @return RESTART if a node changed while it was read
+   */
+  RC tryDescend(int searchKey, PageId& pid, BTLeafNode& leaf, int& less);
+
+  /**
+   * Read a leaf. In concurrent mode the leaf is copied once no writer
+   * holds its latch (see BTLeafNode::detach()).
+   * @param pid[IN] the PageId of the leaf
+   * @param leaf[OUT] the leaf
+   * @return error code. 0 if no error
+   */
+  RC readLeaf(PageId pid, BTLeafNode& leaf);
+
+  /**
+   * @return the PageId of a new node page
+   */
+  PageId newPage();
+
+  /**
+   * Count the entries whose key is not larger than key.
+   * @param key[IN] the largest key to count
+   * @param count[OUT] the number of entries
+   * @return error code. 0 if no error
+   */
+  RC countAtMost(int key, int& count);
+
+  /**
+   * Build the nonleaf levels above a level of nodes.
+   * @param children[IN] the (smallest key, PageId, entry count) of each
+   *                     node of the level below, left to right
+   * @param fillFactor[IN] the fraction of each node to fill
+   * @return error code. 0 if no error
+   */
+  RC buildNonLeafLevels(std::vector<ChildRef>& children, double fillFactor);
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
   PageId   rootPid;    /// the PageId of the root node
   int      treeHeight; /// the height of the tree
+  bool     writable;   /// true if the index was opened in 'w' mode
   /// Note that the content of the above two variables will be gone when
   /// this class is destructed. Make sure to store the values of the two 
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
 
   char buffer[PageFile::PAGE_SIZE];
+
+  LatchTable*         latches;  /// the node latches, NULL unless in concurrent mode
+  OptLatch            meta;     /// guards rootPid and treeHeight in concurrent mode
+  std::atomic<PageId> nextPid;  /// the next free page in concurrent mode
 };
 
 #endif /* BTREEINDEX_H */
@@ -4,26 +4,157 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <strings.h>
 using namespace std;
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BT_X86_SIMD 1
+#endif
+
+// offset of the next-node pointer of a leaf: the last four bytes
+static const int LEAF_NEXT = PageFile::PAGE_SIZE - sizeof(PageId);
+
+typedef int (*KeySearchFn)(const int* keys, int n, int searchKey);
+
+/*
+ * Halve the window [base, base + n) around the first key >= searchKey
+ * until at most block keys are left. The halving compiles to a conditional
+ * move, so there is no branch to mispredict. On return that key lies in
+ * [base, base + n].
+ */
+static inline const int* narrowKeys(const int* base, int& n, int searchKey, int block)
+{
+	while (n > block)
+	{
+		int half = n / 2;
+		base = (base[half] < searchKey) ? base + half : base;
+		n -= half;
+	}
+	return base;
+}
+
+static int binarySearchKeys(const int* keys, int n, int searchKey)
+{
+	if (n == 0) { return 0; }
+	const int* base = narrowKeys(keys, n, searchKey, 1);
+	return (base - keys) + (*base < searchKey);
+}
+
+#ifdef BT_X86_SIMD
+/*
+ * The vector searches narrow the window down to one vector of keys and
+ * count the keys smaller than searchKey in it with a single compare.
+ * The vector may extend past the last key; that is still inside the node
+ * page (the key array is followed by the values), and the extra lanes
+ * are masked off.
+ */
+static int sseSearchKeys(const int* keys, int n, int searchKey)
+{
+	const int* base = narrowKeys(keys, n, searchKey, 4);
+	__m128i v = _mm_loadu_si128((const __m128i*) base);
+	__m128i less = _mm_cmplt_epi32(v, _mm_set1_epi32(searchKey));
+	int mask = _mm_movemask_ps(_mm_castsi128_ps(less)) & ((1 << n) - 1);
+	return (base - keys) + __builtin_popcount(mask);
+}
+
+__attribute__((target("avx2")))
+static int avx2SearchKeys(const int* keys, int n, int searchKey)
+{
+	const int* base = narrowKeys(keys, n, searchKey, 8);
+	__m256i v = _mm256_loadu_si256((const __m256i*) base);
+	__m256i less = _mm256_cmpgt_epi32(_mm256_set1_epi32(searchKey), v);
+	int mask = _mm256_movemask_ps(_mm256_castsi256_ps(less)) & ((1 << n) - 1);
+	return (base - keys) + __builtin_popcount(mask);
+}
+#endif
+
+static bool keySearchSupported(BTKeySearch::Method m)
+{
+	switch (m)
+	{
+	case BTKeySearch::BINARY:
+		return true;
+#ifdef BT_X86_SIMD
+	case BTKeySearch::SSE:
+		return __builtin_cpu_supports("sse2");
+	case BTKeySearch::AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+static KeySearchFn keySearchFunction(BTKeySearch::Method m)
+{
+	switch (m)
+	{
+#ifdef BT_X86_SIMD
+	case BTKeySearch::SSE:
+		return sseSearchKeys;
+	case BTKeySearch::AVX2:
+		return avx2SearchKeys;
+#endif
+	default:
+		return binarySearchKeys;
+	}
+}
+
+/*
+ * The method named by BRUINBASE_KEY_SEARCH, or else the fastest one the
+ * CPU supports.
+ */
+static BTKeySearch::Method defaultKeySearch()
+{
+	BTKeySearch::Method m;
+	const char* s = getenv("BRUINBASE_KEY_SEARCH");
+
+	if (s != NULL)
+	{
+		if (BTKeySearch::parseMethod(s, m) == 0 && keySearchSupported(m)) { return m; }
+		fprintf(stderr, "Warning: key search %s is not available\n", s);
+	}
+
+	if (keySearchSupported(BTKeySearch::AVX2)) { return BTKeySearch::AVX2; }
+	if (keySearchSupported(BTKeySearch::SSE)) { return BTKeySearch::SSE; }
+	return BTKeySearch::BINARY;
+}
+
+BTKeySearch::Method BTKeySearch::current = defaultKeySearch();
+BTKeySearch::SearchFn BTKeySearch::search = keySearchFunction(BTKeySearch::current);
+
+RC BTKeySearch::setMethod(Method m)
+{
+	if (!keySearchSupported(m)) { return RC_INVALID_ATTRIBUTE; }
+	current = m;
+	search = keySearchFunction(m);
+	return 0;
+}
+
+RC BTKeySearch::parseMethod(const char* name, Method& m)
+{
+	if (strcasecmp(name, "binary") == 0) { m = BINARY; }
+	else if (strcasecmp(name, "sse") == 0) { m = SSE; }
+	else if (strcasecmp(name, "avx2") == 0) { m = AVX2; }
+	else { return RC_INVALID_ATTRIBUTE; }
+	return 0;
+}
+
 BTLeafNode::BTLeafNode()
 {
+	buffer = local;
 	fill(buffer, buffer+PageFile::PAGE_SIZE, 0);
-	
+	header()->type = BT_LEAF;
 }
 
 void BTLeafNode::dump()
 {
-	
-	for(int i = 0; i < getKeyCount() * PAIR_SIZE; i += PAIR_SIZE)
+	for(int i = 0; i < getKeyCount(); i++)
 	{
-		int key, pid, sid;
-		memcpy(&key, buffer + i, sizeof(int));
-		memcpy(&pid, buffer + i + sizeof(int), sizeof(PageId));
-		memcpy(&sid, buffer + i + sizeof(int) + sizeof(PageId), sizeof(int));
-		cout << key << " | " << pid << ":" << sid << " || ";
+		cout << keys()[i] << " | " << rids()[i].pid << ":" << rids()[i].sid << " || ";
 	}
-	
+
 	cout << endl;
 }
 
@@ -34,10 +165,34 @@ void BTLeafNode::dump()
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
-{ 
-	return pf.read(pid, buffer);
+{
+	RC rc;
+
+	// work on the cached frame in place instead of copying it
+	buffer = local;
+	if ((rc = pf.pin(pid, page)) < 0) { return rc; }
+	buffer = page.data();
+
+	if (header()->type != BT_LEAF)
+	{
+		page.release();
+		buffer = local;
+		return RC_INVALID_FILE_FORMAT;
+	}
+	return 0;
 }
-    
+
+/*
+ * Copy the content of the node out of its buffer pool frame and unpin it.
+ */
+void BTLeafNode::detach()
+{
+	if (buffer == local) { return; }
+	memcpy(local, buffer, PageFile::PAGE_SIZE);
+	buffer = local;
+	page.release();
+}
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -45,8 +200,8 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
-{ 
-	return pf.write(pid, buffer); 
+{
+	return pf.write(pid, buffer);
 }
 
 /*
@@ -54,19 +209,8 @@ RC BTLeafNode::write(PageId pid, PageFile& pf)
  * @return the number of keys in the node
  */
 int BTLeafNode::getKeyCount()
-{ 
-	int count = 0;
-	char * ptr = buffer;
-	int key;
-	
-	for(int i = 0; i < PageFile::PAGE_SIZE - sizeof(PageId); i += PAIR_SIZE)
-	{
-		memcpy(&key, ptr + i, sizeof(int)); 
-		if (key == 0) { break; }
-		count++;
-	}
-	
-	return count;
+{
+	return header()->keyCount;
 }
 
 /*
@@ -76,29 +220,41 @@ int BTLeafNode::getKeyCount()
  * @return 0 if successful. Return an error code if the node is full.
  */
 RC BTLeafNode::insert(int key, const RecordId& rid)
-{ 
-	
-	if (getKeyCount() == MAX_PAIRS) { return RC_NODE_FULL; }
+{
+	int count = getKeyCount();
+	if (count == MAX_PAIRS) { return RC_NODE_FULL; }
 
 	int eid;
 	locate(key, eid);
-	int bytenum = eid * PAIR_SIZE;
-
-	char *new_buf = (char*) calloc(PageFile::PAGE_SIZE, sizeof(char));
-
-	memcpy(new_buf, buffer, bytenum);
 
-	memcpy(new_buf + bytenum, &key, sizeof(int));
-	memcpy(new_buf + bytenum + sizeof(int), &rid, sizeof(RecordId));
+	// shift the keys and values behind eid by one slot
+	memmove(keys() + eid + 1, keys() + eid, (count - eid) * sizeof(int));
+	memmove(rids() + eid + 1, rids() + eid, (count - eid) * sizeof(RecordId));
 
-	memcpy(new_buf + bytenum + PAIR_SIZE, buffer + bytenum, (getKeyCount() - eid) * PAIR_SIZE);
+	keys()[eid] = key;
+	rids()[eid] = rid;
+	header()->keyCount = count + 1;
 
-	memcpy(buffer, new_buf, PageFile::PAGE_SIZE - sizeof(PageId));
+	return 0;
+}
 
-	free(new_buf);
+/*
+ * Add a (key, rid) pair after the last pair of the node, without a
+ * search. The key must not be smaller than the last key.
+ * @param key[IN] the key to add
+ * @param rid[IN] the RecordId to add
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+RC BTLeafNode::append(int key, const RecordId& rid)
+{
+	int count = getKeyCount();
+	if (count == MAX_PAIRS) { return RC_NODE_FULL; }
 
+	keys()[count] = key;
+	rids()[count] = rid;
+	header()->keyCount = count + 1;
 
-	return 0; 
+	return 0;
 }
 
 /*
@@ -111,38 +267,39 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
  * @param siblingKey[OUT] the first key in the sibling node after split.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
+RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
                               BTLeafNode& sibling, int& siblingKey)
-{ 
+{
+	int count = getKeyCount();
 	int eid;
 	locate(key, eid);
-	int half = (getKeyCount() + 1) / 2;
-	int half_bytenum = half * PAIR_SIZE;
 
-	memcpy(sibling.buffer, buffer + half_bytenum, getKeyCount() * PAIR_SIZE - half_bytenum);
-	fill(buffer + half_bytenum, buffer + getKeyCount() * PAIR_SIZE, 0);
+	// the left half keeps one more pair when the total is odd
+	int half = (count + 2) / 2;
 
-	if (eid < half)
-	{
-		insert(key, rid);
-	}
-	else 
-	{
-		sibling.insert(key, rid);
-	}
+	// the new pair stays here if it falls into the left half: then
+	// [half - 1, count) moves to the sibling, otherwise [half, count)
+	int from = (eid < half) ? half - 1 : half;
+	int moved = count - from;
 
-	PageId sibling_pid;
-	memcpy(&sibling_pid, sibling.buffer + sizeof(int), sizeof(PageId));
+	memcpy(sibling.keys(), keys() + from, moved * sizeof(int));
+	memcpy(sibling.rids(), rids() + from, moved * sizeof(RecordId));
+	sibling.header()->keyCount = moved;
 
-	PageId this_pid;
-	this_pid = getNextNodePtr();
+	// clear the moved pairs
+	fill(keys() + from, keys() + count, 0);
+	fill((char*) (rids() + from), (char*) (rids() + count), 0);
+	header()->keyCount = from;
 
-	setNextNodePtr(sibling_pid);
-	sibling.setNextNodePtr(this_pid);
+	if (eid < half) { insert(key, rid); }
+	else { sibling.insert(key, rid); }
 
-	memcpy(&siblingKey, sibling.buffer, sizeof(int));
+	// the sibling comes right after this node in the leaf chain
+	sibling.setNextNodePtr(getNextNodePtr());
 
-	return 0; 
+	siblingKey = sibling.keys()[0];
+
+	return 0;
 }
 
 /**
@@ -157,24 +314,13 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
  * @return 0 if searchKey is found. Otherwise return an error code.
  */
 RC BTLeafNode::locate(int searchKey, int& eid)
-{ 
-	int key;
-	char *ptr = buffer;
+{
+	int count = getKeyCount();
 
-	for (int i = 0; i < getKeyCount() * PAIR_SIZE; i += PAIR_SIZE)
-	{
-		memcpy(&key, ptr + i, sizeof(int));
-
-		if (key >= searchKey)
-		{
-			eid = i / PAIR_SIZE;
-			if (key != searchKey) { return RC_NO_SUCH_RECORD; }
-			else { return 0; } 
-		}
-	}
+	eid = BTKeySearch::lowerBound(keys(), count, searchKey);
 
-	eid = getKeyCount();
-	return RC_NO_SUCH_RECORD; 
+	if (eid < count && keys()[eid] == searchKey) { return 0; }
+	return RC_NO_SUCH_RECORD;
 }
 
 /*
@@ -185,57 +331,55 @@ RC BTLeafNode::locate(int searchKey, int& eid)
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
-{ 
+{
 
 	if (eid > getKeyCount() - 1 || eid < 0)
 	{
 		return RC_NO_SUCH_RECORD;
 	}
 
-	char *ptr = buffer;
-
-	memcpy(&key, ptr + (eid * PAIR_SIZE), sizeof(int));
-	memcpy(&rid, ptr + (eid * PAIR_SIZE) + sizeof(int), sizeof(RecordId));
+	key = keys()[eid];
+	rid = rids()[eid];
 
-	return 0; 
+	return 0;
 }
 
 /*
  * Return the pid of the next slibling node.
- * @return the PageId of the next sibling node 
+ * @return the PageId of the next sibling node
  */
 PageId BTLeafNode::getNextNodePtr()
-{ 
+{
 	PageId pid = 0;
-	char *ptr = buffer;
 
-	memcpy(&pid, ptr + PageFile::PAGE_SIZE - sizeof(PageId), sizeof(PageId));
+	memcpy(&pid, buffer + LEAF_NEXT, sizeof(PageId));
 
 	return pid;
 }
 
 /*
  * Set the pid of the next slibling node.
- * @param pid[IN] the PageId of the next sibling node 
+ * @param pid[IN] the PageId of the next sibling node
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::setNextNodePtr(PageId pid)
-{ 
+{
 	if (pid < 0)
 	{
 		return RC_INVALID_PID;
 	}
 
-	char *ptr = buffer;
-
-	memcpy(ptr + PageFile::PAGE_SIZE - sizeof(PageId), &pid, sizeof(PageId));
+	memcpy(buffer + LEAF_NEXT, &pid, sizeof(PageId));
 
 	return 0;
 }
 
 BTNonLeafNode::BTNonLeafNode()
 {
+	buffer = local;
 	fill(buffer, buffer + PageFile::PAGE_SIZE, 0);
+	header()->type = BT_NONLEAF;
+	header()->level = 1;
 }
 
 
@@ -246,8 +390,23 @@ BTNonLeafNode::BTNonLeafNode()
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
-{ return pf.read(pid, buffer); }
-    
+{
+	RC rc;
+
+	// work on the cached frame in place instead of copying it
+	buffer = local;
+	if ((rc = pf.pin(pid, page)) < 0) { return rc; }
+	buffer = page.data();
+
+	if (header()->type != BT_NONLEAF)
+	{
+		page.release();
+		buffer = local;
+		return RC_INVALID_FILE_FORMAT;
+	}
+	return 0;
+}
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -262,91 +421,115 @@ RC BTNonLeafNode::write(PageId pid, PageFile& pf)
  * @return the number of keys in the node
  */
 int BTNonLeafNode::getKeyCount()
-{ 
-	int count = 0;
-	char * ptr = buffer;
-	int key;
-	
-	for(int i = sizeof(PageId); i < PageFile::PAGE_SIZE - sizeof(PageId); i += PAIR_SIZE)
-	{
-		memcpy(&key, ptr + i, sizeof(int)); 
-		if (key == 0) { break; }
-		count++;
-	}
-	
-	return count;
+{
+	return header()->keyCount;
 }
 
+/*
+ * Return the level of the node above the leaves.
+ * @return the level of the node
+ */
+int BTNonLeafNode::getLevel()
+{
+	return header()->level;
+}
 
 /*
- * Insert a (key, pid) pair to the node.
+ * Set the level of the node above the leaves.
+ * @param level[IN] the level of the node
+ */
+void BTNonLeafNode::setLevel(int level)
+{
+	header()->level = level;
+}
+
+
+/*
+ * Insert a (key, pid) pair to the node at position eid.
+ * @param eid[IN] the position of the new key
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param count[IN] the number of entries under pid
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid)
-{ 
-	if (getKeyCount() == MAX_PAIRS) { return RC_NODE_FULL; }
-
-	int eid;
-	PageId dummy_data;
-	locateChildPtr(key, dummy_data, eid);
-	int bytenum = sizeof(PageId) + eid * PAIR_SIZE;
-
-	char *new_buf = (char*) calloc(PageFile::PAGE_SIZE, sizeof(char));
-
-	memcpy(new_buf, buffer, bytenum);
-
-	memcpy(new_buf + bytenum, &key, sizeof(int));
-	memcpy(new_buf + bytenum + sizeof(int), &pid, sizeof(PageId));
-
-	memcpy(new_buf + bytenum + PAIR_SIZE, buffer + bytenum, (getKeyCount() - eid) * PAIR_SIZE);
+RC BTNonLeafNode::insert(int eid, int key, PageId pid, int count)
+{
+	int n = getKeyCount();
+	if (n == MAX_PAIRS) { return RC_NODE_FULL; }
+	if (eid < 0 || eid > n) { return RC_INVALID_CURSOR; }
 
-	memcpy(buffer, new_buf, PageFile::PAGE_SIZE);
+	// shift the keys behind eid and the pointers behind them by one slot
+	memmove(keys() + eid + 1, keys() + eid, (n - eid) * sizeof(int));
+	memmove(children() + eid + 2, children() + eid + 1, (n - eid) * sizeof(PageId));
+	memmove(counts() + eid + 2, counts() + eid + 1, (n - eid) * sizeof(int));
 
-	free(new_buf);
+	keys()[eid] = key;
+	children()[eid + 1] = pid;
+	counts()[eid + 1] = count;
+	header()->keyCount = n + 1;
 
-	return 0; 
+	return 0;
 }
 
 /*
- * Insert the (key, pid) pair to the node
+ * Insert the (key, pid) pair to the node at position eid
  * and split the node half and half with sibling.
  * The middle key after the split is returned in midKey.
+ * @param eid[IN] the position of the new key
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param count[IN] the number of entries under pid
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
-{ 
-	int eid;
-	PageId dummy_data;
-	locateChildPtr(key, dummy_data, eid);
-	int bytenum = sizeof(PageId) + eid * PAIR_SIZE;
-	char *new_buf = (char*) calloc(PageFile::PAGE_SIZE + PAIR_SIZE, sizeof(char));
-
-	memcpy(new_buf, buffer, bytenum);
-
-	memcpy(new_buf + bytenum, &key, sizeof(int));
-	memcpy(new_buf + bytenum + sizeof(int), &pid, sizeof(PageId));
-
-	memcpy(new_buf + bytenum + PAIR_SIZE, buffer + bytenum, (getKeyCount() - eid) * PAIR_SIZE);
-
-	int half = (getKeyCount() + 1) / 2;
-	int half_bytenum = sizeof(PageId) + half * PAIR_SIZE;
-
-	
-	memcpy(sibling.buffer, new_buf + half_bytenum + sizeof(int), (getKeyCount() + 1) * PAIR_SIZE - half_bytenum);
-	memcpy(&midKey, new_buf + half_bytenum, sizeof(int));
-	fill(new_buf + half_bytenum, new_buf + (getKeyCount() + 1) * PAIR_SIZE + sizeof(PageId), 0);
-
-	memcpy(buffer, new_buf, PageFile::PAGE_SIZE);
-
-	free(new_buf);
+RC BTNonLeafNode::insertAndSplit(int eid, int key, PageId pid, int count, BTNonLeafNode& sibling, int& midKey)
+{
+	int n = getKeyCount();
+	if (eid < 0 || eid > n) { return RC_INVALID_CURSOR; }
+
+	// lay out all n + 1 keys and n + 2 pointers and counts, the new pair
+	// included, in order
+	int *allKeys = (int*) malloc((n + 1) * sizeof(int));
+	PageId *allPids = (PageId*) malloc((n + 2) * sizeof(PageId));
+	int *allCounts = (int*) malloc((n + 2) * sizeof(int));
+
+	memcpy(allKeys, keys(), eid * sizeof(int));
+	allKeys[eid] = key;
+	memcpy(allKeys + eid + 1, keys() + eid, (n - eid) * sizeof(int));
+
+	memcpy(allPids, children(), (eid + 1) * sizeof(PageId));
+	allPids[eid + 1] = pid;
+	memcpy(allPids + eid + 2, children() + eid + 1, (n - eid) * sizeof(PageId));
+
+	memcpy(allCounts, counts(), (eid + 1) * sizeof(int));
+	allCounts[eid + 1] = count;
+	memcpy(allCounts + eid + 2, counts() + eid + 1, (n - eid) * sizeof(int));
+
+	// keys [0, half) stay here, key half moves up to the parent,
+	// and the keys behind it go to the sibling with their pointers
+	int half = (n + 1) / 2;
+
+	midKey = allKeys[half];
+	memcpy(sibling.keys(), allKeys + half + 1, (n - half) * sizeof(int));
+	memcpy(sibling.children(), allPids + half + 1, (n - half + 1) * sizeof(PageId));
+	memcpy(sibling.counts(), allCounts + half + 1, (n - half + 1) * sizeof(int));
+	sibling.header()->keyCount = n - half;
+	sibling.setLevel(getLevel());
+
+	fill(keys(), keys() + MAX_PAIRS, 0);
+	fill(children(), children() + MAX_PAIRS + 1, 0);
+	fill(counts(), counts() + MAX_PAIRS + 1, 0);
+	memcpy(keys(), allKeys, half * sizeof(int));
+	memcpy(children(), allPids, (half + 1) * sizeof(PageId));
+	memcpy(counts(), allCounts, (half + 1) * sizeof(int));
+	header()->keyCount = half;
+
+	free(allKeys);
+	free(allPids);
+	free(allCounts);
 
-	return 0; 
+	return 0;
 }
 
 /*
@@ -357,24 +540,13 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid, int& eid)
-{ 
-	int key, i;
-	char *ptr = buffer;
-
-	for (i = sizeof(PageId); i < getKeyCount() * PAIR_SIZE; i += PAIR_SIZE)
-	{
-		memcpy(&key, ptr + i, sizeof(int));
-
-		if (key > searchKey)
-		{
-			eid = (i - sizeof(PageId)) / PAIR_SIZE;
-			memcpy(&pid, ptr + i - sizeof(PageId), sizeof(PageId));
-			return 0;
-		}
-	}
-
-	eid = getKeyCount();
-	memcpy(&pid, ptr + i - sizeof(PageId), sizeof(PageId));
+{
+	// follow the pointer left of the first key not smaller than searchKey
+	// (pointer i sits right before key i, pointer 0 being the first child).
+	// a run of equal keys may start in the leaf left of its separator;
+	// readForward() moves on to the next leaf from there.
+	eid = BTKeySearch::lowerBound(keys(), getKeyCount(), searchKey);
+	pid = children()[eid];
 	return 0;
 }
 
@@ -387,24 +559,54 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid, int& eid)
  */
 RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
 {
+	int level = getLevel();
+
 	fill(buffer, buffer + PageFile::PAGE_SIZE, 0);
-	memcpy(buffer, &pid1, sizeof(PageId));
-	insert(key, pid2);
-	return 0; 
+	header()->type = BT_NONLEAF;
+	header()->level = level;
+	children()[0] = pid1;
+	insert(0, key, pid2, 0);
+	return 0;
+}
+
+/*
+ * Return the number of leaf entries under child pointer eid.
+ * @param eid[IN] the child pointer
+ * @return the number of entries
+ */
+int BTNonLeafNode::getChildCount(int eid)
+{
+	return counts()[eid];
+}
+
+/*
+ * Set the number of leaf entries under child pointer eid.
+ * @param eid[IN] the child pointer
+ * @param count[IN] the number of entries
+ */
+void BTNonLeafNode::setChildCount(int eid, int count)
+{
+	counts()[eid] = count;
+}
+
+/*
+ * Return the number of leaf entries under the node.
+ * @return the sum of the entry counts of the children
+ */
+int BTNonLeafNode::getEntryCount()
+{
+	int total = 0;
+	for (int i = 0; i <= getKeyCount(); i++) { total += counts()[i]; }
+	return total;
 }
 
 void BTNonLeafNode::dump()
 {
-	PageId firstPID;
-	memcpy(&firstPID, buffer, sizeof(PageId));
-	cout << firstPID << " | ";
-	for(int i = sizeof(PageId); i < getKeyCount() * PAIR_SIZE; i += PAIR_SIZE)
+	cout << children()[0] << " | ";
+	for(int i = 0; i < getKeyCount(); i++)
 	{
-		int key, pid;
-		memcpy(&key, buffer + i, sizeof(int));
-		memcpy(&pid, buffer + i + sizeof(int), sizeof(PageId));
-		cout << key << ":" << pid << " | ";
+		cout << keys()[i] << ":" << children()[i + 1] << "(" << counts()[i + 1] << ") | ";
 	}
-	
+
 	cout << endl;
-}
\ No newline at end of file
+}
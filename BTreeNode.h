@@ -13,14 +13,88 @@
 #include "RecordFile.h"
 #include "PageFile.h"
 
+/**
+ * The version of the node page format. Version 1 (no version stamp in
+ * the index file) had no node header and ended the key list at the
+ * first key equal to 0. Version 2 interleaved keys with their values.
+ * Version 3 had no entry counts in nonleaf nodes.
+ * BTreeIndex::open() upgrades files of all of them.
+ */
+const int BTREE_FORMAT_VERSION = 4;
+
+/**
+ * The header at the beginning of every B+tree node page.
+ */
+typedef struct {
+  int   keyCount;   // number of keys stored in the node
+  char  type;       // BT_LEAF or BT_NONLEAF
+  char  flags;      // reserved, always 0
+  short level;      // 0 for a leaf, the height above the leaves otherwise
+} BTNodeHeader;
+
+// node types stored in BTNodeHeader::type
+const char BT_LEAF = 1;
+const char BT_NONLEAF = 2;
+
+/**
+ * Search of the sorted key array of a node.
+ * The keys of a node are stored contiguously, so they can be compared
+ * several at a time with SSE (4 keys) or AVX2 (8 keys) instructions.
+ * The fastest method the CPU supports is chosen at startup unless the
+ * BRUINBASE_KEY_SEARCH environment variable (binary, sse or avx2) or
+ * setMethod() says otherwise.
+ */
+class BTKeySearch {
+ public:
+  enum Method { BINARY, SSE, AVX2 };
+
+  /**
+   * Find the first of the n sorted keys that is not smaller than searchKey.
+   * @param keys[IN] the sorted keys
+   * @param n[IN] the number of keys
+   * @param searchKey[IN] the key to search for
+   * @return the index of the key, or n if every key is smaller
+   */
+  static int lowerBound(const int* keys, int n, int searchKey) { return search(keys, n, searchKey); }
+
+  /**
+   * @return the method in use
+   */
+  static Method method() { return current; }
+
+  /**
+   * Switch to another search method.
+   * @param m[IN] the method to use
+   * @return 0 if no error. RC_INVALID_ATTRIBUTE if the CPU does not
+   *         support the method.
+   */
+  static RC setMethod(Method m);
+
+  /**
+   * Convert a method name (binary, sse or avx2) to a Method.
+   * @param name[IN] the name of the method
+   * @param m[OUT] the method
+   * @return 0 if no error. RC_INVALID_ATTRIBUTE if the name is unknown.
+   */
+  static RC parseMethod(const char* name, Method& m);
+
+ private:
+  typedef int (*SearchFn)(const int* keys, int n, int searchKey);
+
+  static SearchFn search;
+  static Method   current;
+};
+
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
+ * Page layout: header, MAX_PAIRS keys, MAX_PAIRS RecordIds,
+ * next-node PageId at the end.
  */
 class BTLeafNode {
   public:
 
     static const int PAIR_SIZE = sizeof(RecordId) + sizeof(int);
-    static const int MAX_PAIRS = 85;
+    static const int MAX_PAIRS = (PageFile::PAGE_SIZE - sizeof(BTNodeHeader) - sizeof(PageId)) / PAIR_SIZE;
 
     // constructor
     BTLeafNode();
@@ -35,10 +109,22 @@ class BTLeafNode {
 
     RC insert(int key, const RecordId& rid);
 
+   /**
+    * Add the (key, rid) pair after the last pair of the node.
+    * The key must not be smaller than the last key in the node.
+    * Used to fill a node with sorted entries, in their order.
+    * @param key[IN] the key to add
+    * @param rid[IN] the RecordId to add
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(int key, const RecordId& rid);
+
    /**
     * Insert the (key, rid) pair to the node
     * and split the node half and half with sibling.
     * The first key of the sibling node is returned in siblingKey.
+    * The sibling takes over the next-node pointer of this node; the
+    * caller must point this node at the sibling once its PageId is known.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert.
     * @param rid[IN] the RecordId to insert.
@@ -94,9 +180,17 @@ class BTLeafNode {
     * Read the content of the node from the page pid in the PageFile pf.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
-    * @return 0 if successful. Return an error code if there is an error.
+    * @return 0 if successful. RC_INVALID_FILE_FORMAT if the page does
+    *         not hold a node of this type.
     */
     RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Copy the content of the node out of the buffer pool frame it was
+    * read into and unpin the frame. Later changes to the page do not
+    * show in the node.
+    */
+    void detach();
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
@@ -108,47 +202,67 @@ class BTLeafNode {
 
   private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. After read() this points directly at the
+    * pinned buffer pool frame of the page; a node that was not read from
+    * disk uses its own memory in local.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char *buffer;
+
+    char local[PageFile::PAGE_SIZE];
+    PinnedPage page;
+
+    BTNodeHeader* header() { return (BTNodeHeader*) buffer; }
+    int* keys() { return (int*) (buffer + sizeof(BTNodeHeader)); }
+    RecordId* rids() { return (RecordId*) (keys() + MAX_PAIRS); }
 }; 
 
 
 /**
  * BTNonLeafNode: The class representing a B+tree nonleaf node.
+ * Page layout: header, MAX_PAIRS keys, MAX_PAIRS + 1 child PageIds,
+ * MAX_PAIRS + 1 child entry counts.
+ * Child pointer i leads to the keys smaller than key i; entry count i is
+ * the number of leaf entries in the subtree under child i.
  */
 class BTNonLeafNode {
   public:
-    static const int PAIR_SIZE = sizeof(int) + sizeof(PageId);
-    static const int MAX_PAIRS = 127;
+    // a key, its child PageId and the child's entry count
+    static const int PAIR_SIZE = sizeof(int) + sizeof(PageId) + sizeof(int);
+    static const int MAX_PAIRS = (PageFile::PAGE_SIZE - sizeof(BTNodeHeader) - sizeof(PageId) - sizeof(int)) / PAIR_SIZE;
 
     BTNonLeafNode();
+
+    void dump();
+
    /**
-    * Insert a (key, pid) pair to the node.
+    * Insert a (key, pid) pair to the node at position eid: the key becomes
+    * key eid and pid becomes child pointer eid + 1. When a child splits,
+    * eid is the position of that child, so that the new node follows it
+    * even among equal keys.
     * Remember that all keys inside a B+tree node should be kept sorted.
+    * @param eid[IN] the position of the new key
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param count[IN] the number of entries under pid
     * @return 0 if successful. Return an error code if the node is full.
     */
-
-    void dump();
-    
-    RC insert(int key, PageId pid);
+    RC insert(int eid, int key, PageId pid, int count);
 
    /**
-    * Insert the (key, pid) pair to the node
+    * Insert the (key, pid) pair to the node at position eid (see insert())
     * and split the node half and half with sibling.
     * The sibling node MUST be empty when this function is called.
     * The middle key after the split is returned in midKey.
     * Remember that all keys inside a B+tree node should be kept sorted.
+    * @param eid[IN] the position of the new key
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param count[IN] the number of entries under pid
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(int eid, int key, PageId pid, int count, BTNonLeafNode& sibling, int& midKey);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
@@ -169,6 +283,53 @@ class BTNonLeafNode {
     */
     RC initializeRoot(PageId pid1, int key, PageId pid2);
 
+   /**
+    * Return key eid of the node.
+    * @param eid[IN] the key number, 0 to getKeyCount() - 1
+    * @return the key
+    */
+    int getKey(int eid) { return keys()[eid]; }
+
+   /**
+    * Return child pointer eid of the node.
+    * @param eid[IN] the child pointer, 0 to getKeyCount()
+    * @return the PageId of the child
+    */
+    PageId getChildPtr(int eid) { return children()[eid]; }
+
+   /**
+    * Return the number of leaf entries under child pointer eid.
+    * @param eid[IN] the child pointer, 0 to getKeyCount()
+    * @return the number of entries
+    */
+    int getChildCount(int eid);
+
+   /**
+    * Set the number of leaf entries under child pointer eid.
+    * @param eid[IN] the child pointer, 0 to getKeyCount()
+    * @param count[IN] the number of entries
+    */
+    void setChildCount(int eid, int count);
+
+   /**
+    * Return the number of leaf entries under the node.
+    * @return the sum of the entry counts of the children
+    */
+    int getEntryCount();
+
+   /**
+    * Return the level of the node: the height of the node above
+    * the leaf level (a parent of leaves is at level 1).
+    * @return the level of the node
+    */
+    int getLevel();
+
+   /**
+    * Set the level of the node.
+    * @param level[IN] the height of the node above the leaf level
+    */
+    void setLevel(int level);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
@@ -179,7 +340,8 @@ class BTNonLeafNode {
     * Read the content of the node from the page pid in the PageFile pf.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
-    * @return 0 if successful. Return an error code if there is an error.
+    * @return 0 if successful. RC_INVALID_FILE_FORMAT if the page does
+    *         not hold a node of this type.
     */
     RC read(PageId pid, const PageFile& pf);
     
@@ -193,10 +355,19 @@ class BTNonLeafNode {
 
   private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. After read() this points directly at the
+    * pinned buffer pool frame of the page; a node that was not read from
+    * disk uses its own memory in local.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char *buffer;
+
+    char local[PageFile::PAGE_SIZE];
+    PinnedPage page;
+
+    BTNodeHeader* header() { return (BTNodeHeader*) buffer; }
+    int* keys() { return (int*) (buffer + sizeof(BTNodeHeader)); }
+    PageId* children() { return (PageId*) (keys() + MAX_PAIRS); }
+    int* counts() { return (int*) (children() + MAX_PAIRS + 1); }
 }; 
 
 #endif /* BTREENODE_H */
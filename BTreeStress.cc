@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * btstress: a stress test and benchmark of concurrent BTreeIndex mode.
+ * Threads insert random keys into one index and look up others at the
+ * same time, first with one thread, then two, four, ... up to the
+ * maximum. It prints the throughput of each run and, at the end, that of
+ * the maximum number of threads against one thread. After each run it
+ * checks that the index holds every entry exactly once, in key order.
+ */
+
+#include "Bruinbase.h"
+#include "BTreeIndex.h"
+#include "BufferPool.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// the number of entries a lookup reads after the key it seeks
+static const int SCAN_LENGTH = 10;
+
+static void usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-t max_threads] [-n ops_per_thread] [-p preload]\n"
+          "       [-r read_percent] [-b buffer_pages] [index_file]\n", prog);
+  exit(1);
+}
+
+/*
+ * what one thread did during a run
+ */
+struct WorkerStats {
+  int inserts;
+  int lookups;
+  int unordered;  // lookups that returned keys out of order
+  RC  rc;
+};
+
+static void work(BTreeIndex* index, int id, int ops, int readPercent, WorkerStats* stats)
+{
+  std::mt19937 rng(id + 1);
+  stats->inserts = stats->lookups = stats->unordered = 0;
+  stats->rc = 0;
+
+  for (int i = 0; i < ops && stats->rc == 0; i++) {
+    int key = rng() & 0x3fffffff;
+
+    if ((int) (rng() % 100) >= readPercent) {
+      RecordId rid = { id, i };
+      stats->rc = index->insert(key, rid);
+      stats->inserts++;
+      continue;
+    }
+
+    // a short range scan from the key, which may cross a leaf split
+    BTreeIndex::Iterator it;
+    RC rc = index->seek(key, it);
+    if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+      stats->rc = rc;
+      break;
+    }
+
+    int k, last = INT_MIN;
+    RecordId rid;
+    for (int j = 0; j < SCAN_LENGTH && it.next(k, rid) == 0; j++) {
+      if (k < last || k < key) stats->unordered++;
+      last = k;
+    }
+    stats->lookups++;
+  }
+}
+
+/*
+ * check that the index holds count entries in key order
+ */
+static bool verify(BTreeIndex& index, int count)
+{
+  BTreeIndex::Iterator it;
+  std::vector<int> none;
+  int key, last = INT_MIN, seen = 0, counted;
+  RecordId rid;
+
+  index.seek(INT_MIN, it);
+  while (it.next(key, rid) == 0) {
+    if (key < last) {
+      fprintf(stderr, "  key %d follows key %d\n", key, last);
+      return false;
+    }
+    last = key;
+    seen++;
+  }
+
+  if (index.countRange(INT_MIN, INT_MAX, none, counted) < 0) counted = -1;
+  if (seen != count || counted != count) {
+    fprintf(stderr, "  %d entries inserted, %d scanned, %d counted\n", count, seen, counted);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  int opt;
+  int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  int ops = 100000;
+  int preload = 100000;
+  int readPercent = 50;
+  int frames = 0;
+
+  while ((opt = getopt(argc, argv, "t:n:p:r:b:")) != -1) {
+    switch (opt) {
+    case 't':
+      if ((maxThreads = atoi(optarg)) <= 0) usage(argv[0]);
+      break;
+    case 'n':
+      if ((ops = atoi(optarg)) <= 0) usage(argv[0]);
+      break;
+    case 'p':
+      if ((preload = atoi(optarg)) < 0) usage(argv[0]);
+      break;
+    case 'r':
+      readPercent = atoi(optarg);
+      if (readPercent < 0 || readPercent > 100) usage(argv[0]);
+      break;
+    case 'b':
+      if ((frames = atoi(optarg)) <= 0) usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind < argc - 1) usage(argv[0]);
+  std::string file = (optind < argc) ? argv[optind] : "btstress.idx";
+
+  if (frames > 0) BufferPool::configure(frames, BufferPool::CLOCK);
+
+  printf("%d ops per thread, %d%% lookups, %d entries preloaded\n", ops, readPercent, preload);
+  printf("threads      ops/sec  speedup\n");
+
+  double base = 0, rate = 0;
+  bool ok = true;
+  for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+    BTreeIndex index;
+    RC rc;
+
+    ::remove(file.c_str());
+    if ((rc = index.open(file, 'w')) < 0) {
+      fprintf(stderr, "Error: cannot open %s (%d)\n", file.c_str(), rc);
+      return 1;
+    }
+    index.setConcurrent(true);
+
+    std::mt19937 rng(0);
+    for (int i = 0; i < preload; i++) {
+      RecordId rid = { -1, i };
+      index.insert(rng() & 0x3fffffff, rid);
+    }
+
+    std::vector<WorkerStats> stats(threads);
+    std::vector<std::thread> workers;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < threads; i++) {
+      workers.push_back(std::thread(work, &index, i, ops, readPercent, &stats[i]));
+    }
+    for (int i = 0; i < threads; i++) workers[i].join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int inserts = 0, unordered = 0;
+    for (int i = 0; i < threads; i++) {
+      inserts += stats[i].inserts;
+      unordered += stats[i].unordered;
+      if (stats[i].rc < 0) {
+        fprintf(stderr, "  thread %d failed (%d)\n", i, stats[i].rc);
+        ok = false;
+      }
+    }
+    if (unordered > 0) {
+      fprintf(stderr, "  %d lookups returned keys out of order\n", unordered);
+      ok = false;
+    }
+
+    rate = (double) threads * ops / seconds;
+    if (threads == 1) base = rate;
+    printf("%7d %12.0f %7.2fx\n", threads, rate, rate / base);
+
+    if (!verify(index, preload + inserts)) ok = false;
+    index.close();
+    if (threads == maxThreads) break;
+  }
+  ::remove(file.c_str());
+
+  BufferPool& pool = BufferPool::get();
+  printf("1 thread %.0f ops/sec, %d threads %.0f ops/sec: %.2fx on %u cores, "
+         "%d buffer frames in %d partitions\n", base, maxThreads, rate, rate / base,
+         std::thread::hardware_concurrency(), pool.frameCount(), pool.partitionCount());
+
+  if (!ok) {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("every run verified\n");
+  return 0;
+}
@@ -0,0 +1,602 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "BufferPool.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <list>
+#include <set>
+#include <utility>
+
+using std::string;
+
+BufferPool* BufferPool::pool = NULL;
+int  BufferPool::pendingFrames = 0;
+BufferPool::Policy BufferPool::pendingPolicy = BufferPool::CLOCK;
+bool BufferPool::pendingSet = false;
+int  BufferPool::pendingWriteBack = -1;
+
+//
+// replacement policies
+//
+
+/**
+ * CLOCK: one reference bit per frame and a sweeping hand.
+ */
+class ClockPolicy : public ReplacementPolicy {
+ public:
+  ClockPolicy(int n) : ref(n, 0), used(n, 0), hand(0) {}
+
+  void loaded(int frame, unsigned long long) { used[frame] = 1; ref[frame] = 1; }
+  void touched(int frame) { ref[frame] = 1; }
+  void removed(int frame) { used[frame] = 0; ref[frame] = 0; }
+
+  int victim(const std::vector<int>& pins)
+  {
+    int n = ref.size();
+
+    // two full sweeps clear every reference bit, so an unpinned
+    // frame is found unless all frames are pinned
+    for (int i = 0; i < 2 * n; i++) {
+      int f = hand;
+      hand = (hand + 1) % n;
+      if (!used[f] || pins[f] > 0) continue;
+      if (ref[f]) { ref[f] = 0; continue; }
+      return f;
+    }
+    return -1;
+  }
+
+ private:
+  std::vector<char> ref;
+  std::vector<char> used;
+  int hand;
+};
+
+/**
+ * LRU-2: evict the page whose second most recent access is the oldest.
+ * pages that were accessed only once have an infinite backward distance
+ * and go first (ordered by their only access).
+ */
+class Lru2Policy : public ReplacementPolicy {
+ public:
+  Lru2Policy(int n) : last(n, 0), prev(n, 0), tick(0) {}
+
+  void loaded(int frame, unsigned long long)
+  {
+    prev[frame] = 0;
+    last[frame] = ++tick;
+    order.insert(entry(frame));
+  }
+
+  void touched(int frame)
+  {
+    order.erase(entry(frame));
+    prev[frame] = last[frame];
+    last[frame] = ++tick;
+    order.insert(entry(frame));
+  }
+
+  void removed(int frame)
+  {
+    order.erase(entry(frame));
+  }
+
+  int victim(const std::vector<int>& pins)
+  {
+    std::set<Entry>::const_iterator it;
+    for (it = order.begin(); it != order.end(); ++it) {
+      if (pins[it->second] == 0) return it->second;
+    }
+    return -1;
+  }
+
+ private:
+  typedef std::pair<std::pair<long long, long long>, int> Entry;
+
+  Entry entry(int frame) const
+    { return Entry(std::make_pair(prev[frame], last[frame]), frame); }
+
+  std::vector<long long> last;   // time of the most recent access
+  std::vector<long long> prev;   // time of the access before that (0: none)
+  std::set<Entry> order;         // frames ordered by (prev, last)
+  long long tick;
+};
+
+/**
+ * 2Q: new pages enter a FIFO queue (A1in). pages that are referenced
+ * again after falling out of A1in, as remembered by the ghost queue A1out,
+ * are promoted to the LRU queue Am.
+ */
+class TwoQPolicy : public ReplacementPolicy {
+ public:
+  TwoQPolicy(int n) : where(n), keys(n, 0), inq(n, NONE)
+  {
+    kin = n / 4 > 0 ? n / 4 : 1;
+    kout = n / 2 > 0 ? n / 2 : 1;
+  }
+
+  void loaded(int frame, unsigned long long key)
+  {
+    keys[frame] = key;
+
+    std::unordered_map<unsigned long long, std::list<unsigned long long>::iterator>::iterator
+      g = ghostPos.find(key);
+    if (g != ghostPos.end()) {
+      // seen recently: this page is hot
+      ghost.erase(g->second);
+      ghostPos.erase(g);
+      am.push_front(frame);
+      where[frame] = am.begin();
+      inq[frame] = AM;
+    } else {
+      a1in.push_front(frame);
+      where[frame] = a1in.begin();
+      inq[frame] = A1IN;
+    }
+  }
+
+  void touched(int frame)
+  {
+    // hits in A1in are ignored (correlated references)
+    if (inq[frame] == AM) {
+      am.erase(where[frame]);
+      am.push_front(frame);
+      where[frame] = am.begin();
+    }
+  }
+
+  void removed(int frame)
+  {
+    if (inq[frame] == A1IN) {
+      a1in.erase(where[frame]);
+      // remember the page in the ghost queue
+      ghost.push_front(keys[frame]);
+      ghostPos[keys[frame]] = ghost.begin();
+      if ((int)ghost.size() > kout) {
+        ghostPos.erase(ghost.back());
+        ghost.pop_back();
+      }
+    } else if (inq[frame] == AM) {
+      am.erase(where[frame]);
+    }
+    inq[frame] = NONE;
+  }
+
+  int victim(const std::vector<int>& pins)
+  {
+    int f;
+
+    // take from A1in once it outgrows its share, otherwise from Am.
+    // fall back to the other queue when every frame of one is pinned.
+    if ((int)a1in.size() > kin || am.empty()) {
+      if ((f = oldest(a1in, pins)) >= 0) return f;
+      return oldest(am, pins);
+    }
+    if ((f = oldest(am, pins)) >= 0) return f;
+    return oldest(a1in, pins);
+  }
+
+ private:
+  enum Queue { NONE, A1IN, AM };
+
+  static int oldest(const std::list<int>& q, const std::vector<int>& pins)
+  {
+    std::list<int>::const_reverse_iterator it;
+    for (it = q.rbegin(); it != q.rend(); ++it) {
+      if (pins[*it] == 0) return *it;
+    }
+    return -1;
+  }
+
+  int kin;    // target size of A1in
+  int kout;   // maximum size of A1out
+  std::list<int> a1in;
+  std::list<int> am;
+  std::list<unsigned long long> ghost;
+  std::unordered_map<unsigned long long, std::list<unsigned long long>::iterator> ghostPos;
+  std::vector<std::list<int>::iterator> where;  // position of a frame in its queue
+  std::vector<unsigned long long> keys;         // page key held by a frame
+  std::vector<char> inq;                        // queue a frame is in
+};
+
+
+//
+// BufferPool
+//
+
+BufferPool& BufferPool::get()
+{
+  if (pool != NULL) return *pool;
+
+  int    frames;
+  Policy policy;
+
+  configuration(frames, policy);
+  pool = new BufferPool(frames, policy);
+
+  if (pendingWriteBack >= 0) {
+    pool->writeBack = (pendingWriteBack != 0);
+  } else {
+    const char* s = getenv("BRUINBASE_WRITE_BACK");
+    pool->writeBack = (s == NULL || atoi(s) != 0);
+  }
+
+  return *pool;
+}
+
+void BufferPool::configuration(int& frames, Policy& policy)
+{
+  if (pendingSet) {
+    frames = pendingFrames;
+    policy = pendingPolicy;
+    return;
+  }
+
+  // take the configuration from the environment
+  const char* s;
+  frames = DEFAULT_FRAME_COUNT;
+  policy = CLOCK;
+  if ((s = getenv("BRUINBASE_BUFFER_PAGES")) != NULL && atoi(s) > 0) {
+    frames = atoi(s);
+  }
+  if ((s = getenv("BRUINBASE_BUFFER_POLICY")) != NULL) {
+    if (parsePolicy(s, policy) < 0) {
+      fprintf(stderr, "Warning: unknown buffer policy %s, using clock\n", s);
+      policy = CLOCK;
+    }
+  }
+}
+
+RC BufferPool::configure(int frames, Policy policy)
+{
+  RC rc;
+
+  // the frames of a pinned page must not be freed under it
+  if (pool != NULL) {
+    for (int p = 0; p < pool->nparts; p++) {
+      const std::vector<int>& pins = pool->parts[p].pins;
+      for (unsigned i = 0; i < pins.size(); i++) {
+        if (pins[i] > 0) return RC_PAGE_PINNED;
+      }
+    }
+
+    // nor may a dirty page that could not be written
+    if ((rc = pool->flushAll()) < 0) return rc;
+  }
+
+  if (frames <= 0) frames = DEFAULT_FRAME_COUNT;
+  pendingFrames = frames;
+  pendingPolicy = policy;
+  pendingSet = true;
+
+  // rebuild the pool if it already exists, keeping the file counters.
+  // swapping the maps keeps their nodes, so the counter pointers stay valid.
+  // every partition knows every open file.
+  if (pool != NULL) {
+    BufferPool* old = pool;
+    pendingWriteBack = old->writeBack;
+    pool = NULL;
+    get();
+    pool->fileStats.swap(old->fileStats);
+    for (int p = 0; p < pool->nparts; p++) {
+      pool->parts[p].openFiles = old->parts[0].openFiles;
+    }
+    delete old;
+  }
+  return 0;
+}
+
+RC BufferPool::setWriteBack(bool on)
+{
+  RC rc;
+
+  // stay in write-back mode while a dirty page could not be written
+  if (pool != NULL && !on && (rc = pool->flushAll()) < 0) return rc;
+
+  pendingWriteBack = on;
+  if (pool != NULL) pool->writeBack = on;
+  return 0;
+}
+
+RC BufferPool::parsePolicy(const char* name, Policy& policy)
+{
+  if (strcasecmp(name, "clock") == 0) policy = CLOCK;
+  else if (strcasecmp(name, "lru2") == 0 || strcasecmp(name, "lru-2") == 0) policy = LRU2;
+  else if (strcasecmp(name, "2q") == 0) policy = TWOQ;
+  else return RC_INVALID_ATTRIBUTE;
+  return 0;
+}
+
+BufferPool::BufferPool(int n, Policy policy)
+  : nframes(n), pol(policy), writeBack(true), hits(0), misses(0)
+{
+  data = new char[(size_t)n * PageFile::PAGE_SIZE];
+
+  nparts = std::max(1, std::min(n / MIN_PARTITION_FRAMES, (int)MAX_PARTITIONS));
+  perPartition = n / nparts;
+  parts = new Partition[nparts];
+
+  for (int p = 0; p < nparts; p++) {
+    Partition& part = parts[p];
+    int size = (p < nparts - 1) ? perPartition : n - p * perPartition;
+
+    part.first = p * perPartition;
+    part.frames.resize(size);
+    part.pins.assign(size, 0);
+
+    // hand out low frames first
+    part.freeFrames.reserve(size);
+    for (int i = size - 1; i >= 0; i--) {
+      part.frames[i].fd = -1;
+      part.frames[i].pid = -1;
+      part.frames[i].dirty = false;
+      part.freeFrames.push_back(part.first + i);
+    }
+    part.pageTable.reserve(size);
+
+    switch (policy) {
+    case LRU2:
+      part.replacer = new Lru2Policy(size);
+      break;
+    case TWOQ:
+      part.replacer = new TwoQPolicy(size);
+      break;
+    default:
+      part.replacer = new ClockPolicy(size);
+      break;
+    }
+  }
+}
+
+BufferPool::~BufferPool()
+{
+  for (int p = 0; p < nparts; p++) delete parts[p].replacer;
+  delete [] parts;
+  delete [] data;
+}
+
+void BufferPool::latchAll(std::vector<std::unique_lock<std::recursive_mutex> >& held)
+{
+  held.reserve(nparts);
+  for (int p = 0; p < nparts; p++) {
+    held.push_back(std::unique_lock<std::recursive_mutex>(parts[p].mutex));
+  }
+}
+
+void BufferPool::attach(int fd, const string& name)
+{
+  std::vector<std::unique_lock<std::recursive_mutex> > held;
+  latchAll(held);
+
+  FileStats& st = fileStats[name];   // zero-initialized on first use
+  for (int p = 0; p < nparts; p++) parts[p].openFiles[fd] = &st;
+}
+
+RC BufferPool::detach(int fd)
+{
+  std::vector<std::unique_lock<std::recursive_mutex> > held;
+  latchAll(held);
+
+  for (int p = 0; p < nparts; p++) {
+    Partition& part = parts[p];
+    for (unsigned i = 0; i < part.frames.size(); i++) {
+      if (part.frames[i].fd == fd && part.pins[i] > 0) return RC_PAGE_PINNED;
+    }
+  }
+
+  for (int p = 0; p < nparts; p++) {
+    Partition& part = parts[p];
+    for (unsigned i = 0; i < part.frames.size(); i++) {
+      if (part.frames[i].fd == fd) release(part, part.first + i);
+    }
+    part.openFiles.erase(fd);
+  }
+  return 0;
+}
+
+int BufferPool::lookup(int fd, PageId pid)
+{
+  Partition& part = partition(fd, pid);
+  std::unordered_map<unsigned long long, int>::const_iterator it;
+  std::unordered_map<int, FileStats*>::iterator f = part.openFiles.find(fd);
+
+  it = part.pageTable.find(makeKey(fd, pid));
+  if (it == part.pageTable.end()) {
+    misses++;
+    if (f != part.openFiles.end()) f->second->misses++;
+    return -1;
+  }
+
+  hits++;
+  if (f != part.openFiles.end()) f->second->hits++;
+  part.replacer->touched(it->second - part.first);
+  return it->second;
+}
+
+int BufferPool::cached(int fd, PageId pid)
+{
+  Partition& part = partition(fd, pid);
+  std::unordered_map<unsigned long long, int>::const_iterator it;
+  it = part.pageTable.find(makeKey(fd, pid));
+  if (it == part.pageTable.end()) return -1;
+  return it->second;
+}
+
+int BufferPool::allocate(int fd, PageId pid)
+{
+  Partition& part = partition(fd, pid);
+  int frame;
+
+  if (!part.freeFrames.empty()) {
+    frame = part.freeFrames.back();
+    part.freeFrames.pop_back();
+  } else {
+    if ((frame = part.replacer->victim(part.pins)) < 0) return -1;
+    frame += part.first;
+
+    // write back the victim (and its dirty neighbors) before reusing it
+    if (frameAt(frame).dirty && writeRun(part, frame) < 0) return -1;
+    release(part, frame);
+    part.freeFrames.pop_back();   // release() put the frame on the free list
+  }
+
+  unsigned long long key = makeKey(fd, pid);
+  Frame& f = part.frames[frame - part.first];
+  f.fd = fd;
+  f.pid = pid;
+  part.pageTable[key] = frame;
+  part.replacer->loaded(frame - part.first, key);
+
+  return frame;
+}
+
+void BufferPool::discard(int fd, PageId pid)
+{
+  Partition& part = partition(fd, pid);
+  std::unordered_map<unsigned long long, int>::iterator it;
+  it = part.pageTable.find(makeKey(fd, pid));
+  if (it != part.pageTable.end()) release(part, it->second);
+}
+
+void BufferPool::release(Partition& part, int frame)
+{
+  Frame& f = part.frames[frame - part.first];
+  if (f.fd < 0) return;
+
+  // only an unpinned frame may be given to another page
+  assert(part.pins[frame - part.first] == 0);
+
+  part.replacer->removed(frame - part.first);
+  part.pageTable.erase(makeKey(f.fd, f.pid));
+  f.fd = -1;
+  f.pid = -1;
+  f.dirty = false;
+  part.freeFrames.push_back(frame);
+}
+
+RC BufferPool::flush(int fd)
+{
+  std::vector<std::unique_lock<std::recursive_mutex> > held;
+  std::vector<std::pair<PageId, int> > dirty;
+
+  latchAll(held);
+  for (int p = 0; p < nparts; p++) {
+    const Partition& part = parts[p];
+    for (unsigned i = 0; i < part.frames.size(); i++) {
+      if (part.frames[i].fd == fd && part.frames[i].dirty) {
+        dirty.push_back(std::make_pair(part.frames[i].pid, part.first + i));
+      }
+    }
+  }
+  std::sort(dirty.begin(), dirty.end());
+
+  // write each run of consecutive pages with a single call
+  int run[MAX_WRITE_RUN];
+  RC  rc = 0;
+  for (unsigned i = 0; i < dirty.size(); ) {
+    int n = 0;
+    do {
+      run[n] = dirty[i + n].second;
+      n++;
+    } while (n < MAX_WRITE_RUN && i + n < dirty.size() &&
+             dirty[i + n].first == dirty[i].first + n);
+
+    RC r = writeFrames(fd, dirty[i].first, run, n);
+    if (r < 0) rc = r;
+    i += n;
+  }
+
+  return rc;
+}
+
+RC BufferPool::flushAll()
+{
+  std::vector<std::unique_lock<std::recursive_mutex> > held;
+  std::set<int> files;
+  RC rc = 0;
+
+  latchAll(held);
+  for (int p = 0; p < nparts; p++) {
+    const Partition& part = parts[p];
+    for (unsigned i = 0; i < part.frames.size(); i++) {
+      if (part.frames[i].dirty) files.insert(part.frames[i].fd);
+    }
+  }
+
+  std::set<int>::const_iterator it;
+  for (it = files.begin(); it != files.end(); ++it) {
+    RC r = flush(*it);
+    if (r < 0) rc = r;
+  }
+  return rc;
+}
+
+RC BufferPool::writeRun(Partition& part, int frame)
+{
+  int    fd = frameAt(frame).fd;
+  PageId first = frameAt(frame).pid;
+  int    n = 1;
+  int    run[MAX_WRITE_RUN];
+  std::unordered_map<unsigned long long, int>::const_iterator it;
+
+  // extend the run backward, then forward, over cached dirty pages.
+  // only the pages of this partition are under its latch.
+  while (n < MAX_WRITE_RUN / 2 && first > 0) {
+    it = part.pageTable.find(makeKey(fd, first - 1));
+    if (it == part.pageTable.end() || !frameAt(it->second).dirty) break;
+    first--;
+    n++;
+  }
+  for (int i = 0; i < n; i++) {
+    run[i] = part.pageTable.find(makeKey(fd, first + i))->second;
+  }
+  while (n < MAX_WRITE_RUN) {
+    it = part.pageTable.find(makeKey(fd, first + n));
+    if (it == part.pageTable.end() || !frameAt(it->second).dirty) break;
+    run[n++] = it->second;
+  }
+
+  return writeFrames(fd, first, run, n);
+}
+
+RC BufferPool::writeFrames(int fd, PageId pid, const int* run, int n)
+{
+  struct iovec iov[MAX_WRITE_RUN];
+
+  for (int i = 0; i < n; i++) {
+    iov[i].iov_base = frameData(run[i]);
+    iov[i].iov_len = PageFile::PAGE_SIZE;
+  }
+
+  if (::pwritev(fd, iov, n, (off_t)pid * PageFile::PAGE_SIZE) != (ssize_t)n * PageFile::PAGE_SIZE) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  for (int i = 0; i < n; i++) frameAt(run[i]).dirty = false;
+  PageFile::writeCount += n;
+
+  return 0;
+}
+
+void BufferPool::printStats(FILE* out) const
+{
+  static const char* names[] = { "clock", "lru2", "2q" };
+
+  fprintf(out, "buffer pool: %d frames in %d partitions, %s policy, %d hits, %d misses\n",
+          nframes, nparts, names[pol], hits.load(), misses.load());
+
+  std::map<string, FileStats>::const_iterator it;
+  for (it = fileStats.begin(); it != fileStats.end(); ++it) {
+    fprintf(out, "  %-20s %10d hits %10d misses\n",
+            it->first.c_str(), it->second.hits.load(), it->second.misses.load());
+  }
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * decides which buffer frame to give up when the pool is full.
+ * the pool notifies the policy of every frame it fills, touches and
+ * empties; the policy only ever hands back the index of a frame.
+ */
+class ReplacementPolicy {
+ public:
+  virtual ~ReplacementPolicy() {}
+
+  /**
+   * a page identified by key was just loaded into frame
+   */
+  virtual void loaded(int frame, unsigned long long key) = 0;
+
+  /**
+   * the page in frame was accessed again (a cache hit)
+   */
+  virtual void touched(int frame) = 0;
+
+  /**
+   * frame was emptied by the pool (file closed or page evicted)
+   */
+  virtual void removed(int frame) = 0;
+
+  /**
+   * pick the frame to evict. only called when every frame is in use.
+   * frames with a non-zero pin count must not be chosen.
+   * @param pins[IN] the pin count of every frame
+   * @return the frame index, or -1 if every frame is pinned
+   */
+  virtual int victim(const std::vector<int>& pins) = 0;
+};
+
+/**
+ * the shared page cache used by every PageFile.
+ * pages are found through a hash table keyed by (file, PageId) and
+ * replaced according to a pluggable policy (CLOCK, LRU-2 or 2Q).
+ * the pool size and policy are taken from the BRUINBASE_BUFFER_PAGES and
+ * BRUINBASE_BUFFER_POLICY environment variables unless configure() is
+ * called before the first page access.
+ *
+ * in write-back mode (the default; BRUINBASE_WRITE_BACK=0 or
+ * setWriteBack(false) turns it off) written pages stay dirty in the pool
+ * and reach the disk only when they are evicted or their file is flushed
+ * or closed. runs of dirty pages with consecutive ids are written with a
+ * single system call.
+ *
+ * threads may share the pool. its frames are split into partitions, each
+ * with its own page table, replacement policy and latch, so that threads
+ * using pages of different partitions do not wait for each other. a page
+ * belongs to the partition its (file, PageId) hashes to; the pages of a
+ * file are hashed in groups of PARTITION_RUN consecutive ids, so that a
+ * run of pages can still be read or written with one call. PageFile takes
+ * latch() of a page around the page operations below (lookup() to
+ * markDirty()); attach(), detach(), flush() and flushAll() work on every
+ * partition and take the latches themselves.
+ */
+class BufferPool {
+ public:
+  enum Policy { CLOCK, LRU2, TWOQ };
+
+  static const int DEFAULT_FRAME_COUNT = 4096;  // 4MB of 1KB pages
+  static const int MAX_WRITE_RUN = 64;          // max # pages per write call
+  static const int PARTITION_RUN = 32;          // # consecutive pages kept in one partition
+  static const int MAX_PARTITIONS = 16;
+  static const int MIN_PARTITION_FRAMES = 512;  // smaller pools are split into fewer partitions
+
+  /**
+   * @return the process-wide buffer pool
+   */
+  static BufferPool& get();
+
+  /**
+   * the number of frames and the replacement policy the pool is (or will
+   * be) created with: those passed to configure(), or else those of the
+   * environment.
+   * @param frames[OUT] number of page frames
+   * @param policy[OUT] replacement policy
+   */
+  static void configuration(int& frames, Policy& policy);
+
+  /**
+   * set the number of frames and the replacement policy.
+   * if the pool already exists, all cached pages are dropped, so this
+   * is refused while any page is pinned.
+   * @param frames[IN] number of page frames
+   * @param policy[IN] replacement policy
+   * @return error code. 0 if no error. RC_PAGE_PINNED if a page is
+   *         pinned, or the error of writing a dirty page; the pool is
+   *         then left as it is
+   */
+  static RC configure(int frames, Policy policy);
+
+  /**
+   * turn write-back caching on or off. dirty pages are flushed first.
+   * @param on[IN] true for write-back, false for write-through
+   * @return error code. 0 if no error. if a dirty page cannot be
+   *         written, the pool stays in write-back mode
+   */
+  static RC setWriteBack(bool on);
+
+  /**
+   * parse a policy name ("clock", "lru2", "2q")
+   * @param name[IN] the policy name
+   * @param policy[OUT] the parsed policy
+   * @return 0 if the name is valid
+   */
+  static RC parsePolicy(const char* name, Policy& policy);
+
+  /**
+   * register an open file so that its hit/miss counters can be reported.
+   * @param fd[IN] the unix file descriptor
+   * @param name[IN] the file name
+   */
+  void attach(int fd, const std::string& name);
+
+  /**
+   * drop every cached page of the file. called when the file is closed,
+   * after its dirty pages were written with flush().
+   * @param fd[IN] the unix file descriptor
+   * @return error code. 0 if no error. RC_PAGE_PINNED if a page of the
+   *         file is pinned; nothing is dropped then
+   */
+  RC detach(int fd);
+
+  /**
+   * write every dirty page of the file to the disk.
+   * @param fd[IN] the unix file descriptor
+   * @return error code. 0 if no error
+   */
+  RC flush(int fd);
+
+  /**
+   * write every dirty page in the pool to the disk.
+   * @return error code. 0 if no error
+   */
+  RC flushAll();
+
+  /**
+   * find a cached page.
+   * @return the frame index, or -1 on a miss
+   */
+  int lookup(int fd, PageId pid);
+
+  /**
+   * find a cached page without counting it as an access
+   * @return the frame index, or -1 if the page is not cached
+   */
+  int cached(int fd, PageId pid);
+
+  /**
+   * allocate a frame for a page that is not cached, evicting another
+   * unpinned page if necessary (and writing it back if it is dirty).
+   * the caller fills the frame.
+   * @return the frame index, or -1 if every frame is pinned or the
+   *         evicted page could not be written
+   */
+  int allocate(int fd, PageId pid);
+
+  /**
+   * forget a cached page (e.g., when loading it failed)
+   */
+  void discard(int fd, PageId pid);
+
+  /**
+   * @return the memory of a frame
+   */
+  char* frameData(int frame) const
+    { return data + (size_t)frame * PageFile::PAGE_SIZE; }
+
+  /**
+   * pin a frame so that it is not evicted until unpin() is called.
+   * pins nest: a frame pinned twice has to be unpinned twice.
+   */
+  void pin(int frame) { owner(frame).pins[local(frame)]++; }
+  void unpin(int frame) { int& p = owner(frame).pins[local(frame)]; if (p > 0) p--; }
+
+  /**
+   * note that a frame differs from its disk page. the frame is written
+   * when it is evicted or its file is flushed.
+   */
+  void markDirty(int frame) { frameAt(frame).dirty = true; }
+
+  /**
+   * @return true if written pages are kept dirty in the pool
+   */
+  bool isWriteBack() const { return writeBack; }
+
+  int frameCount() const { return nframes; }
+  int partitionCount() const { return nparts; }
+  Policy policy() const { return pol; }
+  int hitCount() const { return hits; }
+  int missCount() const { return misses; }
+
+  /**
+   * print the per-file hit and miss counters
+   * @param out[IN] the stream to print to
+   */
+  void printStats(FILE* out) const;
+
+  /**
+   * the latch of the partition a page belongs to. PageFile holds it from
+   * a lookup of the page to the load and pin that follow, so that no
+   * other thread sees the frame being filled or evicted under it. it is
+   * recursive, so a PageFile method that calls another one under the
+   * latch takes it again.
+   * @param fd[IN] the unix file descriptor
+   * @param pid[IN] the page
+   * @return the latch
+   */
+  std::recursive_mutex& latch(int fd, PageId pid) { return partition(fd, pid).mutex; }
+
+ private:
+  BufferPool(int frames, Policy policy);
+  ~BufferPool();
+
+  static unsigned long long makeKey(int fd, PageId pid)
+    { return ((unsigned long long)(unsigned)fd << 32) | (unsigned)pid; }
+
+  struct Frame {
+    int    fd;     // file of the cached page (-1 if the frame is empty)
+    PageId pid;    // page id of the cached page
+    bool   dirty;  // true if the frame has not been written to disk
+  };
+
+  struct FileStats {
+    std::atomic<int> hits;
+    std::atomic<int> misses;
+    FileStats() : hits(0), misses(0) {}
+  };
+
+  // a share of the frames: [first, first + frames.size()) of the pool
+  struct Partition {
+    int first;
+    std::vector<Frame> frames;      // by frame - first
+    std::vector<int>   pins;        // pin count of each frame, by frame - first
+    std::vector<int>   freeFrames;  // frames that hold no page
+    std::unordered_map<unsigned long long, int> pageTable;
+    std::unordered_map<int, FileStats*> openFiles;  // fd -> counters of the file
+    ReplacementPolicy* replacer;    // works on frame - first
+    std::recursive_mutex mutex;     // see latch()
+  };
+
+  Partition& partition(int fd, PageId pid)
+  {
+    unsigned h = (unsigned)fd * 0x9e3779b1u ^ (unsigned)(pid / PARTITION_RUN) * 0x85ebca6bu;
+    return parts[(h ^ (h >> 16)) % nparts];
+  }
+
+  Partition& owner(int frame) const
+    { int p = frame / perPartition; return parts[p < nparts ? p : nparts - 1]; }
+  int local(int frame) const { return frame - owner(frame).first; }
+  Frame& frameAt(int frame) const { Partition& p = owner(frame); return p.frames[frame - p.first]; }
+
+  /**
+   * lock every partition, in order.
+   */
+  void latchAll(std::vector<std::unique_lock<std::recursive_mutex> >& held);
+
+  void release(Partition& part, int frame);
+
+  /**
+   * write the dirty page in frame together with the dirty pages
+   * right before and after it in the same file and partition.
+   */
+  RC writeRun(Partition& part, int frame);
+
+  /**
+   * write the frames of consecutive pages of one file with one call.
+   */
+  RC writeFrames(int fd, PageId pid, const int* run, int n);
+
+  int    nframes;
+  int    nparts;
+  int    perPartition;            // # frames of a partition (the last one takes the rest)
+  Policy pol;
+  bool   writeBack;
+  char*  data;                    // nframes * PAGE_SIZE bytes
+  Partition* parts;
+
+  std::atomic<int> hits;
+  std::atomic<int> misses;
+  std::map<std::string, FileStats> fileStats;  // file name -> counters
+
+  static BufferPool* pool;
+  static int         pendingFrames;
+  static Policy      pendingPolicy;
+  static bool        pendingSet;
+  static int         pendingWriteBack;  // -1: take it from the environment
+};
+
+#endif // BUFFERPOOL_H
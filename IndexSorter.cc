@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "IndexSorter.h"
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+int IndexSorter::budgetMB = 0;
+
+// the smallest block a run is read back in, in entries
+static const size_t MIN_BLOCK = 1024;
+
+static bool entryKeyLess(const IndexEntry& a, const IndexEntry& b)
+{
+  return a.key < b.key;
+}
+
+/*
+ * sort entries by key, keeping the order of equal keys. load files are
+ * often sorted already.
+ */
+static void sortEntries(vector<IndexEntry>& entries)
+{
+  for (size_t i = 1; i < entries.size(); i++) {
+    if (entries[i].key < entries[i - 1].key) {
+      std::stable_sort(entries.begin(), entries.end(), entryKeyLess);
+      return;
+    }
+  }
+}
+
+IndexSorter::IndexSorter(const string& p, size_t bytes) : prefix(p)
+{
+  // half of the budget is left to the buffer of stable_sort()
+  if (bytes == 0) bytes = budget();
+  capacity = std::max(bytes / (2 * sizeof(IndexEntry)), MIN_BLOCK);
+  pos = 0;
+  nspilled = 0;
+  merging = false;
+}
+
+IndexSorter::~IndexSorter()
+{
+  for (size_t i = 0; i < runs.size(); i++) fclose(runs[i]);
+  closeMerge(merge);
+}
+
+size_t IndexSorter::budget()
+{
+  if (budgetMB <= 0) {
+    const char* s = getenv("BRUINBASE_SORT_MB");
+    budgetMB = (s != NULL && atoi(s) > 0) ? atoi(s) : DEFAULT_BUDGET_MB;
+  }
+  return (size_t) budgetMB << 20;
+}
+
+void IndexSorter::setBudget(int mb)
+{
+  budgetMB = std::max(mb, 1);
+}
+
+RC IndexSorter::add(const IndexEntry* e, size_t n)
+{
+  RC rc;
+
+  while (n > 0) {
+    if (entries.empty()) entries.reserve(capacity);
+
+    size_t take = std::min(n, capacity - entries.size());
+    entries.insert(entries.end(), e, e + take);
+    e += take;
+    n -= take;
+
+    if (entries.size() == capacity && (rc = spill()) < 0) return rc;
+  }
+
+  return 0;
+}
+
+RC IndexSorter::finish()
+{
+  RC rc;
+
+  // everything fit in memory: hand the entries out from there
+  if (runs.empty()) {
+    sortEntries(entries);
+    pos = 0;
+    return 0;
+  }
+
+  if (!entries.empty() && (rc = spill()) < 0) return rc;
+  vector<IndexEntry>().swap(entries);
+
+  // merge groups of consecutive runs until a single merge is left.
+  // merging neighbours keeps equal keys in the order they were added
+  while (runs.size() > (size_t) MAX_FAN_IN) {
+    vector<FILE*> merged;
+
+    for (size_t i = 0; i < runs.size(); i += MAX_FAN_IN) {
+      vector<FILE*> group(runs.begin() + i, runs.begin() + std::min(runs.size(), i + MAX_FAN_IN));
+      std::fill(runs.begin() + i, runs.begin() + i + group.size(), (FILE*) NULL);
+
+      Merge m;
+      FILE* out = NULL;
+      vector<IndexEntry> block;
+      IndexEntry entry;
+
+      block.reserve(std::max(capacity / (MAX_FAN_IN + 1), MIN_BLOCK));
+      if ((rc = startMerge(group, m)) == 0 && (rc = openRun(out)) == 0) {
+        while ((rc = nextMerged(m, entry)) == 0) {
+          block.push_back(entry);
+          if (block.size() == block.capacity()) {
+            if (fwrite(&block[0], sizeof(IndexEntry), block.size(), out) != block.size()) {
+              rc = RC_FILE_WRITE_FAILED;
+              break;
+            }
+            block.clear();
+          }
+        }
+        if (rc == RC_END_OF_TREE) {
+          rc = 0;
+          if (!block.empty() && fwrite(&block[0], sizeof(IndexEntry), block.size(), out) != block.size()) {
+            rc = RC_FILE_WRITE_FAILED;
+          }
+          if (rc == 0 && fseek(out, 0, SEEK_SET) != 0) rc = RC_FILE_SEEK_FAILED;
+        }
+      }
+      closeMerge(m);
+
+      if (out != NULL) merged.push_back(out);
+      if (rc < 0) {
+        // the runs not merged yet are closed with the merged ones
+        runs.insert(runs.end(), merged.begin(), merged.end());
+        runs.erase(std::remove(runs.begin(), runs.end(), (FILE*) NULL), runs.end());
+        return rc;
+      }
+    }
+
+    runs.swap(merged);
+  }
+
+  rc = startMerge(runs, merge);
+  runs.clear();
+  merging = true;
+  return rc;
+}
+
+RC IndexSorter::next(IndexEntry& entry)
+{
+  if (merging) return nextMerged(merge, entry);
+
+  if (pos >= entries.size()) return RC_END_OF_TREE;
+  entry = entries[pos++];
+  return 0;
+}
+
+/*
+ * sort the entries in memory and write them to a new run.
+ */
+RC IndexSorter::spill()
+{
+  RC rc;
+  FILE* file;
+
+  sortEntries(entries);
+  if ((rc = openRun(file)) < 0) return rc;
+  runs.push_back(file);
+
+  if (fwrite(&entries[0], sizeof(IndexEntry), entries.size(), file) != entries.size()) {
+    return RC_FILE_WRITE_FAILED;
+  }
+  if (fseek(file, 0, SEEK_SET) != 0) return RC_FILE_SEEK_FAILED;
+
+  entries.clear();
+  nspilled++;
+  return 0;
+}
+
+/*
+ * create an unnamed temporary file next to the prefix.
+ */
+RC IndexSorter::openRun(FILE*& file)
+{
+  string name = prefix + ".XXXXXX";
+  vector<char> path(name.begin(), name.end());
+  path.push_back(0);
+
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  unlink(&path[0]);
+
+  if ((file = fdopen(fd, "w+b")) == NULL) {
+    close(fd);
+    return RC_FILE_OPEN_FAILED;
+  }
+  return 0;
+}
+
+/*
+ * start merging runs; the merge takes over their files. the memory
+ * budget is shared out among the blocks of the runs.
+ */
+RC IndexSorter::startMerge(vector<FILE*>& files, Merge& m)
+{
+  RC rc = 0;
+  size_t blockEntries = std::max(capacity / (files.size() + 1), MIN_BLOCK);
+
+  m.runs.resize(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    m.runs[i].file = files[i];
+    m.runs[i].block.resize(blockEntries);
+    m.runs[i].count = m.runs[i].pos = 0;
+  }
+
+  for (size_t i = 0; i < m.runs.size(); i++) {
+    if ((rc = refill(m.runs[i])) < 0) break;
+    if (m.runs[i].count > 0) m.heap.push_back(i);
+  }
+
+  std::make_heap(m.heap.begin(), m.heap.end(), [&m](int a, int b) { return after(m, a, b); });
+  return rc;
+}
+
+RC IndexSorter::nextMerged(Merge& m, IndexEntry& entry)
+{
+  RC rc;
+  auto later = [&m](int a, int b) { return after(m, a, b); };
+
+  if (m.heap.empty()) return RC_END_OF_TREE;
+
+  // take the smallest entry, from the earliest run among equal keys
+  std::pop_heap(m.heap.begin(), m.heap.end(), later);
+  Run& run = m.runs[m.heap.back()];
+  entry = run.block[run.pos++];
+
+  if (run.pos == run.count && (rc = refill(run)) < 0) return rc;
+  if (run.count > 0) {
+    std::push_heap(m.heap.begin(), m.heap.end(), later);
+  } else {
+    m.heap.pop_back();
+  }
+  return 0;
+}
+
+/*
+ * true if the next entry of run a comes after that of run b: it has a
+ * greater key, or an equal key in a later run.
+ */
+bool IndexSorter::after(const Merge& m, int a, int b)
+{
+  int ka = m.runs[a].block[m.runs[a].pos].key;
+  int kb = m.runs[b].block[m.runs[b].pos].key;
+  return ka > kb || (ka == kb && a > b);
+}
+
+/*
+ * read the next block of a run. run.count is 0 at the end of the run.
+ */
+RC IndexSorter::refill(Run& run)
+{
+  run.count = fread(&run.block[0], sizeof(IndexEntry), run.block.size(), run.file);
+  run.pos = 0;
+  if (run.count == 0 && ferror(run.file)) return RC_FILE_READ_FAILED;
+  return 0;
+}
+
+void IndexSorter::closeMerge(Merge& m)
+{
+  for (size_t i = 0; i < m.runs.size(); i++) {
+    if (m.runs[i].file != NULL) fclose(m.runs[i].file);
+  }
+  m.runs.clear();
+  m.heap.clear();
+}
+
+EntryMerge::EntryMerge(const vector<IndexEntrySource*>& s)
+  : sources(s), heads(s.size()), rc(0), started(false)
+{
+}
+
+RC EntryMerge::next(IndexEntry& entry)
+{
+  RC r;
+  auto later = [this](int a, int b) { return after(a, b); };
+
+  if (rc < 0) return rc;
+
+  // read the first entry of every source
+  if (!started) {
+    started = true;
+    for (size_t i = 0; i < sources.size(); i++) {
+      if ((r = sources[i]->next(heads[i])) == 0) heap.push_back(i);
+      else if (r != RC_END_OF_TREE) return rc = r;
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+  }
+
+  if (heap.empty()) return RC_END_OF_TREE;
+
+  std::pop_heap(heap.begin(), heap.end(), later);
+  int i = heap.back();
+  entry = heads[i];
+
+  if ((r = sources[i]->next(heads[i])) == 0) {
+    std::push_heap(heap.begin(), heap.end(), later);
+  } else if (r == RC_END_OF_TREE) {
+    heap.pop_back();
+  } else {
+    rc = r;
+  }
+  return 0;
+}
+
+/*
+ * true if the next entry of source a comes after that of source b
+ */
+bool EntryMerge::after(int a, int b) const
+{
+  return heads[a].key > heads[b].key || (heads[a].key == heads[b].key && a > b);
+}
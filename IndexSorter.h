@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef INDEXSORTER_H
+#define INDEXSORTER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "BTreeIndex.h"
+
+/**
+ * an external sort of index entries for BTreeIndex::bulkLoad().
+ * entries are added in any key order and collected in memory. once they
+ * fill half the memory budget (the other half is the buffer of the
+ * stable sort), they are sorted and spilled to a temporary file as a
+ * run. finish() sorts the rest; if no run was spilled, the entries are
+ * then handed out from memory, and otherwise the runs are merged, up to
+ * MAX_FAN_IN at a time, by reading each sequentially in blocks. so an
+ * index of any size is built with O(n log n) sequential I/O.
+ *
+ * the entries come out sorted by key; entries of equal keys keep the
+ * order they were added in, as with bulkLoad() of a vector.
+ *
+ * the budget is taken from the BRUINBASE_SORT_MB environment variable
+ * (DEFAULT_BUDGET_MB by default) unless setBudget() is called.
+ */
+class IndexSorter : public IndexEntrySource {
+ public:
+  static const int DEFAULT_BUDGET_MB = 256;
+  static const int MAX_FAN_IN = 64;     // # runs merged at once
+
+  /**
+   * @param prefix[IN] where to create the runs: prefix.XXXXXX. a run
+   *                   file is removed as soon as it is created, and
+   *                   disappears when it is closed
+   * @param bytes[IN] the memory the sort may use; budget() if 0
+   */
+  IndexSorter(const std::string& prefix, size_t bytes = 0);
+  ~IndexSorter();
+
+  /**
+   * @return the memory a sort may use, in bytes
+   */
+  static size_t budget();
+
+  /**
+   * set the memory a sort may use.
+   * @param mb[IN] the budget in megabytes
+   */
+  static void setBudget(int mb);
+
+  /**
+   * add entries to sort.
+   * @param entries[IN] the entries
+   * @param n[IN] the number of entries
+   * @return error code. 0 if no error
+   */
+  RC add(const IndexEntry* entries, size_t n);
+
+  /**
+   * sort what was added. next() then returns the entries in key order.
+   * @return error code. 0 if no error
+   */
+  RC finish();
+
+  /**
+   * produce the next entry in key order (after finish()).
+   * @param entry[OUT] the next entry
+   * @return 0 if an entry was produced, RC_END_OF_TREE after the last
+   *         entry, or another error code
+   */
+  RC next(IndexEntry& entry);
+
+  /**
+   * @return the number of runs spilled to disk
+   */
+  int spilled() const { return nspilled; }
+
+ private:
+  // a sorted run on disk, read back a block at a time
+  struct Run {
+    FILE*                   file;
+    std::vector<IndexEntry> block;
+    size_t                  count;  // # entries read into the block
+    size_t                  pos;    // the next entry of the block
+  };
+
+  // the merge of a group of runs
+  struct Merge {
+    std::vector<Run>  runs;
+    std::vector<int>  heap;   // runs with entries left, smallest (key, run) on top
+  };
+
+  RC spill();
+  RC openRun(FILE*& file);
+  RC startMerge(std::vector<FILE*>& files, Merge& merge);
+  RC nextMerged(Merge& merge, IndexEntry& entry);
+  RC refill(Run& run);
+  static bool after(const Merge& merge, int a, int b);
+  void closeMerge(Merge& merge);
+
+  std::string             prefix;
+  size_t                  capacity;   // # entries held in memory before a spill
+  std::vector<IndexEntry> entries;    // the entries not yet spilled
+  size_t                  pos;        // the next entry to hand out from memory
+  std::vector<FILE*>      runs;       // the spilled runs, in the order of their entries
+  Merge                   merge;      // the final merge
+  int                     nspilled;
+  bool                    merging;    // next() reads from merge
+
+  static int budgetMB;
+
+  IndexSorter(const IndexSorter&);
+  IndexSorter& operator=(const IndexSorter&);
+};
+
+/**
+ * the merge of several sorted streams of index entries into one, for
+ * BTreeIndex::bulkLoad(). among equal keys, the entries of an earlier
+ * source come first.
+ */
+class EntryMerge : public IndexEntrySource {
+ public:
+  /**
+   * @param sources[IN] the streams to merge, each sorted by key
+   */
+  EntryMerge(const std::vector<IndexEntrySource*>& sources);
+
+  /**
+   * produce the next entry in key order.
+   * @param entry[OUT] the next entry
+   * @return 0 if an entry was produced, RC_END_OF_TREE after the last
+   *         entry, or another error code
+   */
+  RC next(IndexEntry& entry);
+
+ private:
+  bool after(int a, int b) const;
+
+  std::vector<IndexEntrySource*> sources;
+  std::vector<IndexEntry>        heads;   // the next entry of each source
+  std::vector<int>               heap;    // sources with entries left, smallest (key, source) on top
+  RC                             rc;      // the first error of a source
+  bool                           started;
+};
+
+#endif // INDEXSORTER_H
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef LATCH_H
+#define LATCH_H
+
+#include <atomic>
+#include <thread>
+#include "PageFile.h"
+
+/**
+ * a version latch for optimistic lock coupling.
+ * a writer locks the latch exclusively; a reader takes no lock at all.
+ * it notes the version before reading and checks afterwards that no
+ * writer locked the latch in between. if one did, what it read may be
+ * torn, and it starts over. the version is odd while a writer holds
+ * the latch.
+ */
+class OptLatch {
+ public:
+  OptLatch() : version(0) {}
+
+  /**
+   * wait until no writer holds the latch.
+   * @return the version to validate() against
+   */
+  unsigned long long readLock() const {
+    unsigned long long v;
+    while ((v = version.load(std::memory_order_acquire)) & 1) std::this_thread::yield();
+    return v;
+  }
+
+  /**
+   * @return true if no writer locked the latch since readLock() returned v
+   */
+  bool validate(unsigned long long v) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == v;
+  }
+
+  /**
+   * lock the latch exclusively, waiting for the writer holding it.
+   */
+  void writeLock() {
+    unsigned long long v = version.load(std::memory_order_relaxed);
+    while ((v & 1) || !version.compare_exchange_weak(v, v + 1, std::memory_order_acquire)) {
+      std::this_thread::yield();
+      v = version.load(std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * unlock the latch. readers that read under the old version restart.
+   */
+  void writeUnlock() { version.fetch_add(1, std::memory_order_release); }
+
+ private:
+  std::atomic<unsigned long long> version;
+};
+
+/**
+ * the latches of the pages of a file, one per PageId.
+ * latches are allocated in chunks the first time a page of the chunk is
+ * latched, so the table grows with the file without ever moving a latch.
+ */
+class LatchTable {
+ public:
+  static const int CHUNK = 1024;          // # latches per chunk
+  static const int MAX_CHUNKS = 1 << 16;  // covers 64M pages
+
+  LatchTable() {
+    for (int i = 0; i < MAX_CHUNKS; i++) chunks[i].store(NULL, std::memory_order_relaxed);
+  }
+
+  ~LatchTable() {
+    for (int i = 0; i < MAX_CHUNKS; i++) delete[] chunks[i].load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @return the latch of page pid
+   */
+  OptLatch& operator[](PageId pid) {
+    std::atomic<OptLatch*>& slot = chunks[pid / CHUNK];
+    OptLatch* chunk = slot.load(std::memory_order_acquire);
+    if (chunk == NULL) {
+      // another thread may install its chunk first; keep that one
+      OptLatch* fresh = new OptLatch[CHUNK];
+      if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) chunk = fresh;
+      else delete[] fresh;
+    }
+    return chunk[pid % CHUNK];
+  }
+
+ private:
+  std::atomic<OptLatch*> chunks[MAX_CHUNKS];
+
+  LatchTable(const LatchTable&);
+  LatchTable& operator=(const LatchTable&);
+};
+
+#endif // LATCH_H
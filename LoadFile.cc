@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "LoadFile.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using std::string_view;
+
+/*
+ * the first byte c in [p, end), or end if there is none. memchr()
+ * compares 16 or 32 bytes at a time (the C library picks SSE2, AVX2 or
+ * EVEX code for the CPU at startup) and never reads past end, which may
+ * be the end of the last mapped page.
+ */
+static inline const char* findByte(const char* p, const char* end, char c)
+{
+  if (p == end) return end;
+  const char* q = (const char*) memchr(p, c, end - p);
+  return (q != NULL) ? q : end;
+}
+
+/*
+ * read an integer from [p, end) the way atoi() does: white space, an
+ * optional sign, then digits. the digit test is a single unsigned
+ * compare, and the value is accumulated without overflow checks, so the
+ * loop has no branch but its exit. (int) of the 64-bit value keeps the
+ * low bits, as atoi() does for values that fit in a long.
+ * @return the first byte after the digits
+ */
+static const char* parseKey(const char* p, const char* end, int& key)
+{
+  while (p < end && (*p == ' ' || (unsigned char) (*p - '\t') <= '\r' - '\t')) p++;
+
+  const char* sign = p;
+  bool negative = (p < end && *p == '-');
+  if (p < end && (*p == '-' || *p == '+')) p++;
+
+  const char* digits = p;
+  unsigned long long n = 0;
+  unsigned d;
+  while (p < end && (d = (unsigned char) *p - '0') < 10) {
+    n = n * 10 + d;
+    p++;
+  }
+
+  // longer numbers may not fit in 64 bits, where atoi() saturates
+  if (p - digits > 18) {
+    key = atoi(string(sign, p - sign).c_str());
+    return p;
+  }
+
+  key = (int) (negative ? 0 - n : n);
+  return p;
+}
+
+LoadFile::LoadFile()
+{
+  fd = -1;
+  map = NULL;
+  size = 0;
+  data = NULL;
+  pos = end = 0;
+  eof = false;
+}
+
+LoadFile::~LoadFile()
+{
+  close();
+}
+
+RC LoadFile::open(const string& filename)
+{
+  struct stat statbuf;
+
+  if (fd >= 0) return RC_FILE_OPEN_FAILED;
+
+  fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  if (::fstat(fd, &statbuf) < 0) {
+    close();
+    return RC_FILE_OPEN_FAILED;
+  }
+
+  data = NULL;
+  pos = end = 0;
+  eof = false;
+
+  // a regular file is mapped and read front to back
+  if (S_ISREG(statbuf.st_mode)) {
+    size = statbuf.st_size;
+    eof = true;
+    if (size == 0) return 0;
+
+    void* addr = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      map = (char*) addr;
+      ::madvise(map, size, MADV_SEQUENTIAL);
+      data = map;
+      end = size;
+      return 0;
+    }
+    eof = false;
+  }
+
+  // read anything else (or a file that cannot be mapped) in blocks
+  block.resize(BLOCK_SIZE);
+  data = &block[0];
+  return 0;
+}
+
+RC LoadFile::close()
+{
+  RC rc = 0;
+
+  if (map != NULL) ::munmap(map, size);
+  if (fd >= 0 && ::close(fd) < 0) rc = RC_FILE_CLOSE_FAILED;
+
+  fd = -1;
+  map = NULL;
+  size = 0;
+  std::vector<char>().swap(block);
+  data = NULL;
+  pos = end = 0;
+  eof = false;
+
+  return rc;
+}
+
+int LoadFile::fill()
+{
+  // keep the partial line at the front of the block, and make room for
+  // a line longer than the block
+  memmove(&block[0], &block[pos], end - pos);
+  end -= pos;
+  pos = 0;
+  if (end == block.size()) block.resize(2 * block.size());
+  data = &block[0];
+
+  ssize_t n = ::read(fd, &block[end], block.size() - end);
+  if (n < 0) return RC_FILE_READ_FAILED;
+  if (n == 0) eof = true;
+  end += n;
+  return n;
+}
+
+RC LoadFile::next(string_view& line)
+{
+  size_t scanned = pos;  // no newline in [pos, scanned)
+
+  for (;;) {
+    const char* nl = findByte(data + scanned, data + end, '\n');
+    if (nl < data + end) {
+      line = string_view(data + pos, nl - (data + pos));
+      pos = nl + 1 - data;
+      return 0;
+    }
+
+    // the last line may have no newline
+    if (eof) {
+      if (pos == end) return RC_END_OF_FILE;
+      line = string_view(data + pos, end - pos);
+      pos = end;
+      return 0;
+    }
+
+    scanned = end - pos;
+    int n = fill();
+    if (n < 0) return n;
+  }
+}
+
+RC LoadFile::nextChunk(size_t bytes, string_view& chunk)
+{
+  // have the chunk in the block, unless the file ends first
+  while (!eof && end - pos < bytes) {
+    int n = fill();
+    if (n < 0) return n;
+  }
+  if (pos == end) return RC_END_OF_FILE;
+
+  // end the chunk after its last newline
+  size_t cut = std::min(end, pos + bytes);
+  const char* nl = (const char*) memrchr(data + pos, '\n', cut - pos);
+
+  // a line longer than the chunk: the chunk ends with it
+  size_t scanned = cut;
+  while (nl == NULL) {
+    nl = findByte(data + scanned, data + end, '\n');
+    if (nl < data + end) break;
+    nl = NULL;
+
+    if (eof) {
+      chunk = string_view(data + pos, end - pos);
+      pos = end;
+      return 0;
+    }
+
+    scanned = end - pos;
+    int n = fill();
+    if (n < 0) return n;
+  }
+
+  chunk = string_view(data + pos, nl + 1 - (data + pos));
+  pos = nl + 1 - data;
+  return 0;
+}
+
+bool LoadFile::takeLine(string_view& text, string_view& line)
+{
+  if (text.empty()) return false;
+
+  const char* end = text.data() + text.size();
+  const char* nl = findByte(text.data(), end, '\n');
+  line = string_view(text.data(), nl - text.data());
+  text = (nl < end) ? string_view(nl + 1, end - nl - 1) : string_view();
+  return true;
+}
+
+RC LoadFile::next(int& key, string_view& value)
+{
+  RC rc;
+  string_view line;
+
+  if ((rc = next(line)) < 0) return rc;
+
+  // an empty line ends the load
+  if (line.empty()) return RC_END_OF_FILE;
+
+  return parseLine(line, key, value);
+}
+
+RC LoadFile::parseLine(string_view line, int& key, string_view& value)
+{
+  const char* s = line.data();
+  const char* end = s + line.size();
+
+  // ignore beginning white spaces
+  while (s < end && (*s == ' ' || *s == '\t')) s++;
+
+  // get the integer key value
+  s = parseKey(s, end, key);
+
+  // look for comma
+  s = findByte(s, end, ',');
+  if (s == end) return RC_INVALID_FILE_FORMAT;
+
+  // ignore white spaces
+  do { s++; } while (s < end && (*s == ' ' || *s == '\t'));
+
+  // if there is nothing left, set the value to empty string
+  if (s == end) {
+    value = string_view();
+    return 0;
+  }
+
+  // a value delimited by ' or " ends at the closing quote, if any;
+  // any other value runs to the end of the line
+  char c = *s;
+  if (c == '\'' || c == '"') {
+    s++;
+    end = findByte(s, end, c);
+  }
+  value = string_view(s, end - s);
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef LOADFILE_H
+#define LOADFILE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * a load file (a .del file) read line by line for SqlEngine::load().
+ * a regular file is memory-mapped; anything else (a pipe, a terminal) is
+ * read in blocks of BLOCK_SIZE bytes. lines and values are handed out as
+ * string_views into the mapping or the block, so no line is copied.
+ * newlines, commas and closing quotes are found with memchr(), which
+ * compares many bytes at a time with vector instructions.
+ */
+class LoadFile {
+ public:
+  static const int BLOCK_SIZE = 1 << 20;  // bytes read at a time from a non-regular file
+
+  LoadFile();
+  ~LoadFile();
+
+  /**
+   * open a load file.
+   * @param filename[IN] the name of the file
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename);
+
+  /**
+   * close the load file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * read the next line, without its newline. the line stays valid
+   * until the next call of next() or close().
+   * @param line[OUT] the line
+   * @return error code. 0 if no error. RC_END_OF_FILE after the last line.
+   */
+  RC next(std::string_view& line);
+
+  /**
+   * read the next line and parse it into a (key, value) pair (see
+   * parseLine()).
+   * @param key[OUT] the key of the line
+   * @param value[OUT] the value of the line, valid until the next call
+   * @return error code. 0 if no error. RC_END_OF_FILE after the last
+   *         line or at an empty line. RC_INVALID_FILE_FORMAT if the line
+   *         has no comma.
+   */
+  RC next(int& key, std::string_view& value);
+
+  /**
+   * read the lines of the next chunk of the file, about bytes long, or
+   * longer if a single line is. the chunk ends with a newline except at
+   * the end of the file. it stays valid until close() if the file is
+   * mapped (see mapped()), or else until the next call of nextChunk().
+   * @param bytes[IN] the size of the chunk wanted
+   * @param chunk[OUT] the chunk
+   * @return error code. 0 if no error. RC_END_OF_FILE at the end of the file.
+   */
+  RC nextChunk(size_t bytes, std::string_view& chunk);
+
+  /**
+   * @return true if the file is memory-mapped
+   */
+  bool mapped() const { return map != NULL; }
+
+  /**
+   * take the first line, without its newline, off a chunk of lines.
+   * @param text[IN/OUT] the lines; on return, the lines after the first
+   * @param line[OUT] the first line
+   * @return false if text is empty
+   */
+  static bool takeLine(std::string_view& text, std::string_view& line);
+
+  /**
+   * parse a line of a load file into the (key, value) pair.
+   * the key is the integer before the first comma (read like atoi()).
+   * the value is the rest of the line after the comma and any spaces or
+   * tabs. a value starting with ' or " ends before the next quote of the
+   * same kind, or at the end of the line if there is none.
+   * @param line[IN] a line from a load file
+   * @param key[OUT] the key field of the tuple in the line
+   * @param value[OUT] the value field of the tuple in the line, a part of line
+   * @return error code. 0 if no error. RC_INVALID_FILE_FORMAT if the
+   *         line has no comma.
+   */
+  static RC parseLine(std::string_view line, int& key, std::string_view& value);
+
+ private:
+  /**
+   * read more of a non-regular file into the block, keeping the part of
+   * the block from pos on.
+   * @return the number of bytes read, 0 at the end of the file, or an
+   *         error code
+   */
+  int fill();
+
+  int         fd;      // the file descriptor of the load file (-1 if closed)
+  char*       map;     // the mapping of a regular file (NULL otherwise)
+  size_t      size;    // the size of the mapping
+  std::vector<char> block;  // the block read from a non-regular file
+  const char* data;    // the mapping, or the block
+  size_t      pos;     // the start of the next line in data
+  size_t      end;     // the end of the bytes available in data
+  bool        eof;     // true once a non-regular file is read up
+
+  LoadFile(const LoadFile&);
+  LoadFile& operator=(const LoadFile&);
+};
+
+#endif // LOADFILE_H
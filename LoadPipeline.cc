@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "LoadPipeline.h"
+#include "IndexSorter.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/*
+ * a chunk of whole lines of the load file. the text is in the mapping of
+ * the file, or in storage if the file is not mapped.
+ */
+struct LoadChunk {
+  long         seq;      // the position of the chunk in the file
+  string_view  text;
+  vector<char> storage;
+};
+
+/*
+ * the rows parsed from a chunk. the values point into the chunk text,
+ * so a batch keeps the storage of its chunk.
+ */
+struct ParsedBatch {
+  vector<Row>   rows;
+  vector<char>  storage;
+  long long     bytes;  // # bytes of the chunk the rows came from
+  RC            rc;     // RC_END_OF_FILE at an empty line, the parse
+                        // error that ended the batch, or 0
+};
+
+/*
+ * the index entries of a batch of appended rows.
+ */
+struct IndexBatch {
+  vector<IndexEntry> entries;
+  long long          bytes;
+};
+
+/*
+ * a queue of at most capacity items. close() wakes every waiting thread:
+ * push() then fails, and pop() fails once the queue is empty.
+ */
+template <class T>
+class BoundedQueue {
+ public:
+  BoundedQueue(size_t n) : capacity(n), closed(false) {}
+
+  bool push(T&& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+    if (closed) return false;
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  bool pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+    if (items.empty()) return false;
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+
+ private:
+  std::mutex              mutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+  std::deque<T>           items;
+  size_t                  capacity;
+  bool                    closed;
+};
+
+/*
+ * a queue that hands out the items of a numbered sequence in order, as
+ * they are pushed in any order. it holds at most capacity items, but
+ * always takes the next item of the sequence, which the consumer waits
+ * for; so producers blocked on a full queue cannot starve the consumer.
+ */
+template <class T>
+class OrderedQueue {
+ public:
+  OrderedQueue(size_t n) : capacity(n), next(0), total(-1), closed(false) {}
+
+  bool push(long seq, T&& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [&] { return items.size() < capacity || seq == next || closed; });
+    if (closed) return false;
+    items[seq] = std::move(item);
+    if (seq == next) ready.notify_one();
+    return true;
+  }
+
+  bool pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [this] { return items.count(next) > 0 || next == total || closed; });
+    if (items.count(next) == 0) return false;
+    item = std::move(items[next]);
+    items.erase(next++);
+    notFull.notify_all();
+    return true;
+  }
+
+  // the sequence has n items; pop() fails after the last one
+  void finish(long n)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    total = n;
+    ready.notify_all();
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notFull.notify_all();
+    ready.notify_all();
+  }
+
+ private:
+  std::mutex              mutex;
+  std::condition_variable notFull;
+  std::condition_variable ready;
+  std::map<long, T>       items;
+  size_t                  capacity;
+  long                    next;    // the next item to pop
+  long                    total;   // # items of the sequence, -1 until known
+  bool                    closed;
+};
+
+struct LoadPipeline::Queues {
+  BoundedQueue<LoadChunk>    chunks;
+  OrderedQueue<ParsedBatch>  parsed;
+  BoundedQueue<IndexBatch>   entries;
+  std::mutex                 statsMutex;  // guards parseStats
+
+  Queues() : chunks(QUEUE_DEPTH), parsed(QUEUE_DEPTH), entries(QUEUE_DEPTH) {}
+};
+
+LoadPipeline::LoadPipeline(LoadFile& f, RecordFile& r, TableCatalog& c,
+                           BTreeIndex* i, bool b, const string& t)
+  : file(f), rf(r), catalog(c), index(i), bulk(b), table(t)
+{
+  queues = NULL;
+  stopped = false;
+  readRc = appendRc = indexRc = 0;
+
+  StageStats none = { 0, 0, 0, 0 };
+  parseStats = appendStats = indexStats = none;
+  elapsed = 0;
+  spilled = 0;
+}
+
+RC LoadPipeline::run(int parsers)
+{
+  Queues q;
+  vector<std::thread> threads;
+  Clock::time_point start = Clock::now();
+
+  queues = &q;
+  parseStats.threads = parsers;
+  appendStats.threads = 1;
+  indexStats.threads = (index != NULL) ? 1 : 0;
+
+  threads.push_back(std::thread(&LoadPipeline::read, this));
+  for (int i = 0; i < parsers; i++) threads.push_back(std::thread(&LoadPipeline::parse, this));
+  if (index != NULL) threads.push_back(std::thread(&LoadPipeline::insert, this));
+
+  append();
+
+  // let the stages before the append stage run out, and the index stage
+  // finish the entries it was given
+  q.chunks.close();
+  q.parsed.close();
+  q.entries.close();
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+  queues = NULL;
+  elapsed = seconds(start);
+
+  if (appendRc < 0) return appendRc;
+  if (indexRc < 0) return indexRc;
+  return readRc;
+}
+
+/*
+ * the read stage: cut the file into chunks for the parsers.
+ */
+void LoadPipeline::read()
+{
+  RC rc = 0;
+  long seq = 0;
+  string_view text;
+
+  while (!stopped && (rc = file.nextChunk(CHUNK_BYTES, text)) == 0) {
+    LoadChunk chunk;
+    chunk.seq = seq;
+    chunk.text = text;
+
+    // a chunk of a file read in blocks is overwritten by the next one
+    if (!file.mapped()) {
+      chunk.storage.assign(text.begin(), text.end());
+      chunk.text = string_view(chunk.storage.data(), chunk.storage.size());
+    }
+
+    if (!queues->chunks.push(std::move(chunk))) break;
+    seq++;
+  }
+
+  if (!stopped && rc < 0 && rc != RC_END_OF_FILE) {
+    fprintf(stderr, "Error: could not read the load file\n");
+    readRc = rc;
+  }
+
+  // the parsers take the chunks left, and the append stage ends after
+  // the last one
+  queues->parsed.finish(seq);
+  queues->chunks.close();
+}
+
+/*
+ * the parse stage: turn chunks into batches of (key, value).
+ */
+void LoadPipeline::parse()
+{
+  LoadChunk chunk;
+  StageStats stats = { 0, 0, 0, 0 };
+
+  while (queues->chunks.pop(chunk)) {
+    Clock::time_point start = Clock::now();
+    ParsedBatch batch;
+    string_view rest = chunk.text, line;
+    Row row;
+
+    batch.rc = 0;
+    batch.rows.reserve(chunk.text.size() / 32);
+    while (LoadFile::takeLine(rest, line)) {
+      // an empty line ends the load
+      if (line.empty()) {
+        batch.rc = RC_END_OF_FILE;
+        break;
+      }
+      if ((batch.rc = LoadFile::parseLine(line, row.key, row.value)) < 0) break;
+      batch.rows.push_back(row);
+    }
+    batch.bytes = chunk.text.size() - rest.size();
+    batch.storage.swap(chunk.storage);
+
+    stats.rows += batch.rows.size();
+    stats.bytes += batch.bytes;
+    stats.busy += seconds(start);
+
+    if (!queues->parsed.push(chunk.seq, std::move(batch))) break;
+  }
+
+  std::lock_guard<std::mutex> lock(queues->statsMutex);
+  parseStats.rows += stats.rows;
+  parseStats.bytes += stats.bytes;
+  parseStats.busy += stats.busy;
+}
+
+/*
+ * the append stage: append the batches to the table in file order.
+ */
+void LoadPipeline::append()
+{
+  ParsedBatch batch;
+  vector<RecordId> rids;
+
+  while (queues->parsed.pop(batch)) {
+    Clock::time_point start = Clock::now();
+    IndexBatch out;
+    size_t n = batch.rows.size();
+    size_t i = n;
+    RecordId first = rf.endRid();
+
+    if (index != NULL) rids.resize(n);
+    if ((appendRc = rf.appendBatch(batch.rows.data(), n, (index != NULL) ? rids.data() : NULL)) < 0) {
+      fprintf(stderr, "Error: could not add to table\n");
+
+      // the rows before the end of the table were stored
+      RecordId last = rf.endRid();
+      i = (size_t) (last.pid - first.pid) * RecordFile::RECORDS_PER_PAGE + last.sid - first.sid;
+    }
+
+    if (index != NULL) out.entries.resize(i);
+    for (size_t j = 0; j < i; j++) {
+      catalog.add(batch.rows[j].key, batch.rows[j].value.size());
+      if (index != NULL) {
+        out.entries[j].key = batch.rows[j].key;
+        out.entries[j].rid = rids[j];
+      }
+    }
+
+    if (appendRc == 0 && batch.rc < 0 && batch.rc != RC_END_OF_FILE) {
+      fprintf(stderr, "Error: could not parse line\n");
+      appendRc = batch.rc;
+    }
+
+    // the rows appended go to the index even if the batch failed
+    out.bytes = (appendRc == 0) ? batch.bytes : 0;
+    appendStats.rows += i;
+    appendStats.bytes += out.bytes;
+    appendStats.busy += seconds(start);
+
+    if (index != NULL) queues->entries.push(std::move(out));
+    if (appendRc < 0 || batch.rc < 0) break;
+  }
+
+  // stop the stages before this one
+  stopped = true;
+}
+
+/*
+ * the index stage: add the appended rows to the index.
+ */
+void LoadPipeline::insert()
+{
+  IndexBatch batch;
+  IndexSorter sorter(table + ".idx");   // the entries for bulkLoad()
+
+  while (queues->entries.pop(batch)) {
+    Clock::time_point start = Clock::now();
+
+    if (bulk) {
+      if (indexRc == 0 && (indexRc = sorter.add(batch.entries.data(), batch.entries.size())) < 0) {
+        fprintf(stderr, "Error: could not sort the index entries for table %s\n", table.c_str());
+      }
+    } else {
+      for (size_t i = 0; i < batch.entries.size() && indexRc == 0; i++) {
+        if ((indexRc = index->insert(batch.entries[i].key, batch.entries[i].rid)) < 0) {
+          fprintf(stderr, "Error: could not add to index for table\n");
+        }
+      }
+    }
+
+    indexStats.rows += batch.entries.size();
+    indexStats.bytes += batch.bytes;
+    indexStats.busy += seconds(start);
+  }
+
+  // merge the sorted runs straight into the leaves
+  if (bulk && indexRc == 0) {
+    Clock::time_point start = Clock::now();
+    if ((indexRc = sorter.finish()) < 0) {
+      fprintf(stderr, "Error: could not sort the index entries for table %s\n", table.c_str());
+    } else if ((indexRc = index->bulkLoad(sorter)) < 0) {
+      fprintf(stderr, "Error: could not build index for table %s\n", table.c_str());
+    }
+    indexStats.busy += seconds(start);
+  }
+  spilled = sorter.spilled();
+}
+
+void LoadPipeline::report(FILE* stream) const
+{
+  const double MB = 1024.0 * 1024.0;
+
+  fprintf(stream, "  -- load: %lld rows, %.1f MB in %.2f s\n",
+          appendStats.rows, appendStats.bytes / MB, elapsed);
+
+  if (spilled > 0) {
+    fprintf(stream, "  --   index entries sorted in %d runs on disk\n", spilled);
+  }
+
+  const char* names[] = { "parse", "append", "index" };
+  const StageStats* stages[] = { &parseStats, &appendStats, &indexStats };
+  for (int i = 0; i < 3; i++) {
+    const StageStats& s = *stages[i];
+    if (s.threads == 0) continue;
+
+    // the rate of the stage as a whole: its threads work side by side
+    double busy = (s.busy > 0) ? s.busy / s.threads : 0;
+    if (busy > 0) {
+      fprintf(stream, "  --   %-6s (%d thread%s): %.0f rows/s, %.1f MB/s\n", names[i], s.threads,
+              (s.threads == 1) ? "" : "s", s.rows / busy, s.bytes / MB / busy);
+    } else {
+      fprintf(stream, "  --   %-6s (%d thread%s): idle\n", names[i], s.threads, (s.threads == 1) ? "" : "s");
+    }
+  }
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef LOADPIPELINE_H
+#define LOADPIPELINE_H
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include "Bruinbase.h"
+#include "BTreeIndex.h"
+#include "LoadFile.h"
+#include "RecordFile.h"
+#include "TableCatalog.h"
+
+/**
+ * the stages of SqlEngine::load(), run side by side on their own threads
+ * and connected by bounded queues:
+ *
+ *   read:   a thread cuts the load file into chunks of whole lines
+ *   parse:  parser threads turn each chunk into a batch of (key, value)
+ *   append: the calling thread appends the batches to the RecordFile, in
+ *           the order of the file, a page at a time with appendBatch(),
+ *           and passes on (key, RecordId) batches
+ *   index:  a thread inserts them into the index, or sorts them with an
+ *           IndexSorter (spilling runs beyond its memory budget) and
+ *           merges them into BTreeIndex::bulkLoad()
+ *
+ * the table, the index and the catalog end up exactly as a load of one
+ * line at a time leaves them. the load stops at the first empty line or
+ * the first line that does not parse, after the lines before it.
+ */
+class LoadPipeline {
+ public:
+  static const int CHUNK_BYTES = 256 * 1024;  // the load file read per parse task
+  static const int QUEUE_DEPTH = 8;           // batches waiting between two stages
+
+  /**
+   * @param file[IN] the open load file
+   * @param rf[IN] the table to append to
+   * @param catalog[IN] the statistics to add the rows to
+   * @param index[IN] the index to add the rows to, or NULL
+   * @param bulk[IN] true to build the (empty) index with bulkLoad()
+   * @param table[IN] the name of the table, for error messages
+   */
+  LoadPipeline(LoadFile& file, RecordFile& rf, TableCatalog& catalog,
+               BTreeIndex* index, bool bulk, const std::string& table);
+
+  /**
+   * load the file.
+   * @param parsers[IN] the number of parser threads
+   * @return error code. 0 if no error
+   */
+  RC run(int parsers);
+
+  /**
+   * print the number of rows loaded and the throughput of each stage:
+   * rows and megabytes of the load file per second of its work, not
+   * counting the time it waited for the stages next to it.
+   * @param stream[IN] the stream to print to
+   */
+  void report(FILE* stream) const;
+
+ private:
+  // the work of a stage
+  struct StageStats {
+    long long rows;     // # rows handled
+    long long bytes;    // # bytes of the load file they came from
+    double    busy;     // seconds of work, summed over the threads
+    int       threads;  // # threads of the stage
+  };
+
+  void read();
+  void parse();
+  void append();
+  void insert();
+
+  LoadFile&     file;
+  RecordFile&   rf;
+  TableCatalog& catalog;
+  BTreeIndex*   index;
+  bool          bulk;
+  std::string   table;
+
+  struct Queues;
+  Queues* queues;             // the queues between the stages during run()
+  std::atomic<bool> stopped;  // set once the append stage stops early
+
+  RC readRc;     // the error of the read stage
+  RC appendRc;   // the error of the append stage
+  RC indexRc;    // the error of the index stage
+
+  StageStats parseStats;
+  StageStats appendStats;
+  StageStats indexStats;
+  double     elapsed;   // seconds run() took
+  int        spilled;   // # sorted runs of index entries written to disk
+
+  LoadPipeline(const LoadPipeline&);
+  LoadPipeline& operator=(const LoadPipeline&);
+};
+
+#endif // LOADPIPELINE_H
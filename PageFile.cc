@@ -9,28 +9,51 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "BufferPool.h"
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 using std::string;
 
-int PageFile::readCount = 0;
-int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+// the byte offset of a page in the file
+static inline off_t pageOffset(PageId pid)
+{
+  return (off_t)pid * PageFile::PAGE_SIZE;
+}
+
+std::atomic<int> PageFile::readCount(0);
+std::atomic<int> PageFile::writeCount(0);
+
+// held while a page is looked up in the buffer pool (see BufferPool::latch())
+typedef std::lock_guard<std::recursive_mutex> PoolLatch;
+
+// raise the end pid to cover pid. writers of pages in different
+// partitions of the buffer pool may do so at the same time.
+static void extendTo(std::atomic<PageId>& epid, PageId pid)
+{
+  PageId end = epid;
+  while (pid >= end && !epid.compare_exchange_weak(end, pid + 1)) ;
+}
 
 PageFile::PageFile() 
 { 
   fd = -1; 
   epid = 0; 
+  map = NULL;
+  pins = 0;
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
   epid = 0;
+  map = NULL;
+  pins = 0;
   open(filename.c_str(), mode);
 }
 
@@ -46,6 +69,8 @@ RC PageFile::open(const string& filename, char mode)
   switch (mode) {
   case 'r':
   case 'R':
+  case 'm':
+  case 'M':
     oflag = O_RDONLY;
     break;
   case 'w':
@@ -65,29 +90,57 @@ RC PageFile::open(const string& filename, char mode)
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
   epid = statbuf.st_size / PAGE_SIZE;
 
+  // map the whole file in 'm' mode. pages are then read from the
+  // mapping, so they are not cached in the buffer pool.
+  if ((mode == 'm' || mode == 'M') && epid > 0) {
+    void* addr = ::mmap(NULL, (size_t)epid * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) { ::close(fd); fd = -1; epid = 0; return RC_FILE_OPEN_FAILED; }
+    map = (char*)addr;
+  }
+
+  // register the file with the buffer pool for per-file statistics
+  BufferPool::get().attach(fd, filename);
+
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
-
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
+  // a page still pinned would point into a frame (or the mapping) that
+  // is about to be reused; the file stays open until it is released
+  if (pins > 0) return RC_PAGE_PINNED;
+
+  // write the dirty pages of this file and evict all its cached pages.
+  // this must happen before the fd can be reused by another open()
+  BufferPool& pool = BufferPool::get();
+  rc = pool.flush(fd);
+  RC detached = pool.detach(fd);
+  if (detached < 0) return detached;
+
+  // unmap the file in 'm' mode
+  if (map != NULL) {
+    ::munmap(map, (size_t)epid * PAGE_SIZE);
+    map = NULL;
   }
 
+  // close the file
+  if (::close(fd) < 0) rc = RC_FILE_CLOSE_FAILED;
+
   // set the fd and epid to the initial state
   fd = -1; 
   epid = 0;
-  return 0;
+  return (rc < 0) ? rc : 0;
+}
+
+RC PageFile::flush()
+{
+  if (fd <= 0 || map != NULL) return 0;
+
+  return BufferPool::get().flush(fd);
 }
 
 PageId PageFile::endPid() const 
@@ -95,35 +148,63 @@ PageId PageFile::endPid() const
   return epid;
 }
 
-RC PageFile::seek(PageId pid) const
+RC PageFile::advise(Access access)
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  int advice;
+
+  if (map == NULL) return 0;
+
+  switch (access) {
+  case SEQUENTIAL:
+    advice = MADV_SEQUENTIAL;
+    break;
+  case RANDOM:
+    advice = MADV_RANDOM;
+    break;
+  default:
+    advice = MADV_NORMAL;
+    break;
+  }
+
+  return (::madvise(map, (size_t)epid * PAGE_SIZE, advice) < 0) ? RC_FILE_READ_FAILED : 0;
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
   if (pid < 0) return RC_INVALID_PID; 
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+  // a memory-mapped file is read-only
+  if (map != NULL) return RC_FILE_WRITE_FAILED;
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
-
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+  BufferPool& pool = BufferPool::get();
+  PoolLatch latch(pool.latch(fd, pid));
+  int frame = pool.cached(fd, pid);
+
+  // in write-back mode, keep the page dirty in the buffer pool.
+  // if every frame is pinned, fall through and write it directly.
+  if (pool.isWriteBack()) {
+    if (frame < 0) frame = pool.allocate(fd, pid);
+    if (frame >= 0) {
+      // (the buffer may be a pinned frame that was modified in place)
+      if (pool.frameData(frame) != buffer) memcpy(pool.frameData(frame), buffer, PAGE_SIZE);
+      pool.markDirty(frame);
+      extendTo(epid, pid);
+      return 0;
     }
   }
 
+  // write the buffer to the disk page
+  if (::pwrite(fd, buffer, PAGE_SIZE, pageOffset(pid)) != PAGE_SIZE) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  // if the page is in the buffer pool, keep the cached copy up to date
+  if (frame >= 0 && pool.frameData(frame) != buffer) {
+    memcpy(pool.frameData(frame), buffer, PAGE_SIZE);
+  }
+
   // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+  extendTo(epid, pid);
 
   // increase page write count
   writeCount++;
@@ -137,44 +218,212 @@ RC PageFile::read(PageId pid, void* buffer) const
 
   if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
 
+  // a memory-mapped page is copied straight from the mapping
+  if (map != NULL) {
+    memcpy(buffer, map + (size_t)pid * PAGE_SIZE, PAGE_SIZE);
+    readCount++;
+    return 0;
+  }
+
   //
-  // if the page is in cache, read it from there
+  // if the page is in the buffer pool, read it from there
   //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
-    }
+  BufferPool& pool = BufferPool::get();
+  PoolLatch latch(pool.latch(fd, pid));
+  int frame = pool.lookup(fd, pid);
+  if (frame < 0 && (rc = load(pid, frame)) < 0) return rc;
+
+  memcpy(buffer, pool.frameData(frame), PAGE_SIZE);
+
+  return 0;
+}
+
+RC PageFile::pin(PageId pid, PinnedPage& page) const
+{
+  RC rc;
+
+  page.release();
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  // a memory-mapped page needs no frame. it is read-only, so it
+  // must not be marked dirty.
+  if (map != NULL) {
+    page.file = this;
+    page.frame = -1;
+    page.pid = pid;
+    page.ptr = map + (size_t)pid * PAGE_SIZE;
+    page.dirty = false;
+    pins++;
+    readCount++;
+    return 0;
   }
 
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
-    }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+  BufferPool& pool = BufferPool::get();
+  PoolLatch latch(pool.latch(fd, pid));
+  int frame = pool.lookup(fd, pid);
+  if (frame < 0 && (rc = load(pid, frame)) < 0) return rc;
+
+  pool.pin(frame);
+  page.file = this;
+  page.frame = frame;
+  page.pid = pid;
+  page.ptr = pool.frameData(frame);
+  page.dirty = false;
+  pins++;
+
+  return 0;
+}
+
+RC PageFile::unpin(PinnedPage& page) const
+{
+  RC rc = 0;
+
+  if (page.file != this || page.ptr == 0) return RC_INVALID_PID;
+
+  // a memory-mapped page holds no frame of the pool
+  if (page.frame >= 0) {
+    BufferPool& pool = BufferPool::get();
+    PoolLatch latch(pool.latch(fd, page.pid));
+
+    // leave the modified page dirty in the pool in write-back mode,
+    // otherwise write it through to the disk
+    if (page.dirty) {
+      if (pool.isWriteBack()) {
+        pool.markDirty(page.frame);
+      } else if (::pwrite(fd, page.ptr, PAGE_SIZE, pageOffset(page.pid)) != PAGE_SIZE) {
+        rc = RC_FILE_WRITE_FAILED;
+      } else {
+        writeCount++;
+      }
     }
+
+    pool.unpin(page.frame);
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
+  pins--;
+
+  page.file = 0;
+  page.frame = -1;
+  page.pid = -1;
+  page.ptr = 0;
+  page.dirty = false;
+
+  return rc;
+}
+
+RC PageFile::load(PageId pid, int& frame) const
+{
+  BufferPool& pool = BufferPool::get();
+
+  // get a frame, evicting another page if the pool is full
+  if ((frame = pool.allocate(fd, pid)) < 0) return RC_FILE_READ_FAILED;
  
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
+  // read the page into the frame
+  if (::pread(fd, pool.frameData(frame), PAGE_SIZE, pageOffset(pid)) != PAGE_SIZE) {
+    pool.discard(fd, pid);
     return RC_FILE_READ_FAILED;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
 
   // increase the page read count
   readCount++;
 
   return 0;
 }
+
+RC PageFile::readRange(PageId pid, int count, void* buffers[]) const
+{
+  if (pid < 0 || count < 0 || pid + count > epid) return RC_INVALID_PID;
+
+  // a memory-mapped file is copied straight from the mapping
+  if (map != NULL) {
+    for (int i = 0; buffers != NULL && i < count; i++) {
+      memcpy(buffers[i], map + pageOffset(pid + i), PAGE_SIZE);
+    }
+    readCount += count;
+    return 0;
+  }
+
+  // the pages of each partition of the buffer pool are read under its latch
+  for (int i = 0; i < count; ) {
+    int n = std::min(count - i, BufferPool::PARTITION_RUN - (pid + i) % BufferPool::PARTITION_RUN);
+    RC  rc = readSpan(pid + i, n, (buffers != NULL) ? buffers + i : NULL);
+    if (rc < 0) return rc;
+    i += n;
+  }
+
+  return 0;
+}
+
+RC PageFile::readSpan(PageId pid, int count, void* buffers[]) const
+{
+  BufferPool& pool = BufferPool::get();
+  PoolLatch latch(pool.latch(fd, pid));
+  struct iovec iov[MAX_RANGE];
+  int   run[MAX_RANGE];
+  int   next = pool.lookup(fd, pid);
+
+  for (int i = 0; i < count; ) {
+    // a cached page is simply copied out of its frame
+    if (next >= 0) {
+      if (buffers != NULL) memcpy(buffers[i], pool.frameData(next), PAGE_SIZE);
+      if (++i < count) next = pool.lookup(fd, pid + i);
+      continue;
+    }
+
+    // collect the run of uncached pages starting at pid + i into pinned
+    // frames, so that they can be read with a single system call
+    int n = 0;
+    do {
+      int frame = pool.allocate(fd, pid + i + n);
+      if (frame < 0) break;
+      pool.pin(frame);
+      run[n] = frame;
+      iov[n].iov_base = pool.frameData(frame);
+      iov[n].iov_len = PAGE_SIZE;
+      n++;
+      next = (i + n < count) ? pool.lookup(fd, pid + i + n) : -1;
+    } while (n < MAX_RANGE && i + n < count && next < 0);
+
+    // every frame of the pool is pinned
+    if (n == 0) return RC_FILE_READ_FAILED;
+
+    if (::preadv(fd, iov, n, pageOffset(pid + i)) != (ssize_t)n * PAGE_SIZE) {
+      for (int j = 0; j < n; j++) {
+        pool.unpin(run[j]);
+        pool.discard(fd, pid + i + j);
+      }
+      return RC_FILE_READ_FAILED;
+    }
+    readCount += n;
+
+    for (int j = 0; j < n; j++) {
+      if (buffers != NULL) memcpy(buffers[i + j], pool.frameData(run[j]), PAGE_SIZE);
+      pool.unpin(run[j]);
+    }
+    i += n;
+  }
+
+  return 0;
+}
+
+RC PageFile::prefetch(PageId pid, int count) const
+{
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+  if (count > epid - pid) count = epid - pid;
+
+  // let the kernel read ahead the mapped pages.
+  // madvise() wants an address aligned to the system page size.
+  if (map != NULL) {
+    off_t  align = ::sysconf(_SC_PAGESIZE);
+    off_t  begin = pageOffset(pid) / align * align;
+    size_t len = pageOffset(pid + count) - begin;
+    return (::madvise(map + begin, len, MADV_WILLNEED) < 0) ? RC_FILE_READ_FAILED : 0;
+  }
+
+  return readRange(pid, count, NULL);
+}
+
+RC PinnedPage::release()
+{
+  if (ptr == 0) return 0;
+  return file->unpin(*this);
+}
@@ -10,35 +10,119 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
+#include <atomic>
 #include <string>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
+class PageFile;
+
 /**
- * read/write a file in the unit of a page
+ * a page of a PageFile pinned in the buffer pool.
+ * data() points directly at the cached frame, so the page can be read
+ * (and modified) in place without copying it. the page stays in the pool
+ * until release() is called or the PinnedPage is destroyed.
+ */
+class PinnedPage {
+ public:
+  PinnedPage() : file(0), frame(-1), pid(-1), ptr(0), dirty(false) {}
+  ~PinnedPage() { release(); }
+
+  /**
+   * @return the page content, or NULL if no page is pinned
+   */
+  char* data() const { return ptr; }
+
+  /**
+   * @return the id of the pinned page
+   */
+  PageId pageId() const { return pid; }
+
+  /**
+   * @return true if a page is pinned
+   */
+  bool pinned() const { return ptr != 0; }
+
+  /**
+   * note that the page was modified in place.
+   * a dirty page is written to disk when it is released.
+   */
+  void markDirty() { dirty = true; }
+
+  /**
+   * unpin the page. the pointer returned by data() becomes invalid.
+   * @return error code. 0 if no error
+   */
+  RC release();
+
+ private:
+  // a pinned frame must be unpinned exactly once
+  PinnedPage(const PinnedPage&);
+  PinnedPage& operator=(const PinnedPage&);
+
+  friend class PageFile;
+
+  const PageFile* file;   // the file the page belongs to
+  int    frame;           // the buffer pool frame holding the page
+  PageId pid;             // the pinned page
+  char*  ptr;             // the frame memory
+  bool   dirty;           // true if the page was modified in place
+};
+
+/**
+ * read/write a file in the unit of a page.
+ * several threads may read, pin and write pages of the same file at once,
+ * as the concurrent inserts of BTreeIndex do. pages are read and written
+ * with positional I/O, and only the partition of the buffer pool holding
+ * a page is latched while it is used; two threads must not write the same
+ * page at once. opening and closing a file is left to one thread.
  */
 class PageFile {
  public:
 
   static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
 
+  // maximum # pages fetched by a single system call in readRange()
+  static const int MAX_RANGE = 32;
+
+  // expected access pattern of a memory-mapped file
+  enum Access { NORMAL, SEQUENTIAL, RANDOM };
+
   PageFile();
   PageFile(const std::string& filename, char mode);
 
   /**
-   * open a file in read or write mode.
+   * open a file in read, write or memory-mapped mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * in 'm' mode the file is read-only and mapped into memory as a whole;
+   * read() and pin() are served from the mapping without any system call
+   * and without going through the buffer pool.
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for memory-mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& filename, char mode);
 
   /**
-   * close the file.
+   * tell the kernel how a memory-mapped file will be accessed.
+   * this is a no-op unless the file was opened in 'm' mode.
+   * @param access[IN] the expected access pattern
    * @return error code. 0 if no error
    */
+  RC advise(Access access);
+
+  /**
+   * @return true if the file was opened in 'm' mode; its pages are then
+   *         pinned without taking frames of the buffer pool
+   */
+  bool mapped() const { return map != NULL; }
+
+  /**
+   * close the file.
+   * @return error code. 0 if no error. RC_PAGE_PINNED if a page of the
+   *         file is still pinned; the file then stays open
+   */
   RC close();
   
   /**
@@ -48,16 +132,64 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
+
+  /**
+   * read a run of consecutive disk pages into memory buffers.
+   * pages that are not cached are fetched with one preadv() call per
+   * run of up to MAX_RANGE pages (that do not cross a partition of the
+   * buffer pool) and are kept in the buffer pool.
+   * @param pid[IN] the first page to read
+   * @param count[IN] the number of pages to read
+   * @param buffers[OUT] count memory buffers, one per page. if NULL,
+   *                     the pages are only loaded into the buffer pool.
+   * @return error code. 0 if no error
+   */
+  RC readRange(PageId pid, int count, void* buffers[]) const;
+
+  /**
+   * load a run of consecutive pages into the buffer pool ahead of use.
+   * the run is cut at the end of the file.
+   * @param pid[IN] the first page to load
+   * @param count[IN] the number of pages to load
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count) const;
+
+  /**
+   * pin a disk page in the buffer pool and give direct access to it.
+   * any page previously held by the PinnedPage is released first.
+   * @param pid[IN] the page to pin
+   * @param page[OUT] the pinned page
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, PinnedPage& page) const;
+
+  /**
+   * unpin a page pinned by pin(). if the page was marked dirty,
+   * it is written to the disk (or left dirty in the buffer pool in
+   * write-back mode).
+   * @param page[IN/OUT] the page to unpin
+   * @return error code. 0 if no error
+   */
+  RC unpin(PinnedPage& page) const;
   
   /**
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * when the buffer pool is in write-back mode, the page is only copied
+   * to the pool and reaches the disk on eviction, flush() or close().
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * write every dirty page of the file held in the buffer pool to the disk.
+   * @return error code. 0 if no error
+   */
+  RC flush();
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -67,7 +199,7 @@ class PageFile {
   PageId endPid() const;
 
   /**
-   * @return the total # of disk reads
+   * @return the total # of disk reads (buffer pool misses)
    */
   static int getPageReadCount()  { return readCount; }
   
@@ -76,37 +208,31 @@ class PageFile {
    */
   static int getPageWriteCount() { return writeCount; }
 
+  // the buffer pool writes back dirty pages and counts them
+  friend class BufferPool;
+
  protected:
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
+   * read a page that is not cached into a newly allocated pool frame.
+   * @param pid[IN] the page to read
+   * @param frame[OUT] the frame holding the page
    * @return error code. 0 if no error
    */
-  RC seek(PageId pid) const;
+  RC load(PageId pid, int& frame) const;
+
+  /**
+   * readRange() for pages of one partition of the buffer pool.
+   */
+  RC readSpan(PageId pid, int count, void* buffers[]) const;
 
  private:
   int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
-
-  //
-  // the following set of members implement LRU caching 
-  //
-  static const int CACHE_COUNT = 10;
-
-  static int cacheClock; // clock tick counter for LRU policy
-
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
-
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  std::atomic<PageId> epid;  // (last page id + 1) of the file
+  char*   map;    // the mapping of the file in 'm' mode (NULL otherwise)
+  mutable std::atomic<int> pins;  // # pages of the file pinned by PinnedPages
+
+  static std::atomic<int> readCount;  // total # of page reads 
+  static std::atomic<int> writeCount; // total # of page writes 
 };
   
 #endif // PAGEFILE_H
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "ParallelScan.h"
+#include "ResultSink.h"
+#include "BufferPool.h"
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+int ParallelScan::nthreads = 0;
+
+int ParallelScan::threads()
+{
+  if (nthreads > 0) return nthreads;
+
+  const char* s = getenv("BRUINBASE_THREADS");
+  if (s != NULL && atoi(s) > 0) nthreads = atoi(s);
+  else nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+  return nthreads;
+}
+
+void ParallelScan::setThreads(int n)
+{
+  nthreads = std::max(n, 1);
+}
+
+int ParallelScan::workersFor(PageId pages)
+{
+  int morsels = (pages + MORSEL_PAGES - 1) / MORSEL_PAGES;
+
+  // every worker keeps a batch of pages pinned, plus the run of pages
+  // being prefetched; leave the other half of the pool to the rest
+  int frames = BufferPool::get().frameCount() / (2 * (RecordBatch::MAX_PAGES + PageFile::MAX_RANGE));
+
+  return std::max(1, std::min(std::min(threads(), morsels), frames));
+}
+
+/*
+ * the result of a task (a morsel, or a key sub-range of an index scan):
+ * its count and matching rows. the values are
+ * packed NUL-terminated into one string; offsets[i] is where the value of
+ * row i starts.
+ */
+struct MorselResult {
+  int    count;
+  RC     rc;
+  bool   done;
+  vector<int>    keys;
+  vector<size_t> offsets;
+  string values;
+
+  MorselResult() : count(0), rc(0), done(false) {}
+};
+
+/*
+ * the tasks dealt to one worker. the owner pops from the front, in page
+ * or key order; thieves take from the back, the tasks needed last.
+ */
+class MorselQueue {
+ public:
+  void push(int morsel) { morsels.push_back(morsel); }
+
+  bool pop(int& morsel) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (morsels.empty()) return false;
+    morsel = morsels.front();
+    morsels.pop_front();
+    return true;
+  }
+
+  bool steal(int& morsel) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (morsels.empty()) return false;
+    morsel = morsels.back();
+    morsels.pop_back();
+    return true;
+  }
+
+ private:
+  std::mutex      mutex;
+  std::deque<int> morsels;
+};
+
+/*
+ * the state shared by the workers of a scan
+ */
+struct ScanState {
+  int                 attr;
+  const Predicate*    pred;
+  const RecordFile*   rf;
+  BTreeIndex*         index;   // NULL for a heap scan
+  vector<int>         bounds;  // the first key of each sub-range of an index scan
+  vector<MorselQueue> queues;
+  vector<MorselResult> results;
+
+  std::mutex              mutex;  // guards MorselResult::done
+  std::condition_variable finished;
+
+  ScanState(int workers, int tasks) : index(NULL), queues(workers), results(tasks) {}
+};
+
+/*
+ * add a matching row to a result
+ */
+static void keep(MorselResult& result, int attr, int key, const char* value)
+{
+  result.keys.push_back(key);
+  result.offsets.push_back(result.values.size());
+  if (attr != 1) result.values.append(value);
+  result.values.push_back('\0');
+}
+
+/*
+ * scan one morsel into its result
+ */
+static void scanMorsel(ScanState& state, int m)
+{
+  MorselResult& result = state.results[m];
+  RecordBatch batch;
+  unsigned long long selected[RecordBatch::CAPACITY / 64];
+  RecordId rid, end;
+
+  rid.pid = m * ParallelScan::MORSEL_PAGES;
+  rid.sid = 0;
+  end.pid = rid.pid + ParallelScan::MORSEL_PAGES;
+  end.sid = 0;
+
+  while (true) {
+    if ((result.rc = state.rf->readBatch(rid, end, batch)) < 0) break;
+    if (batch.count == 0) break;
+
+    int matched = state.pred->filter(batch, selected);
+    result.count += matched;
+    if (state.attr == 4 || matched == 0) continue;
+
+    for (int w = 0; w * 64 < batch.count; w++) {
+      for (unsigned long long bits = selected[w]; bits != 0; bits &= bits - 1) {
+        int i = w * 64 + __builtin_ctzll(bits);
+        keep(result, state.attr, batch.keys[i], batch.values[i]);
+      }
+    }
+  }
+}
+
+/*
+ * scan key sub-range m of an index scan into its result, with an
+ * iterator of its own
+ */
+static void scanRange(ScanState& state, int m)
+{
+  static const int BATCH = 64;
+
+  MorselResult& result = state.results[m];
+  const KeyRange& range = state.pred->keys();
+  BTreeIndex::Iterator it;
+  IndexEntry entries[BATCH];
+  int n, key;
+  string value;
+
+  // the records are only read for their values
+  bool fetch = state.attr == 2 || state.attr == 3 || state.pred->hasValueConditions();
+
+  int lo = state.bounds[m];
+  int hi = (m + 1 < (int) state.bounds.size()) ? state.bounds[m + 1] - 1 : range.hi;
+
+  result.rc = state.index->seekRange(lo, hi, it);
+  if (result.rc == RC_NO_SUCH_RECORD) result.rc = 0;
+  if (result.rc < 0) return;
+
+  while ((n = it.next(entries, BATCH)) > 0) {
+    for (int e = 0; e < n; e++) {
+      key = entries[e].key;
+      if (range.excludes(key)) continue;
+
+      if (fetch) {
+        if ((result.rc = state.rf->read(entries[e].rid, key, value)) < 0) return;
+        if (!state.pred->matchesValue(value)) continue;
+      }
+
+      result.count++;
+      if (state.attr != 4) keep(result, state.attr, key, value.c_str());
+    }
+  }
+  if (n < 0) result.rc = n;
+}
+
+static void work(ScanState& state, int self)
+{
+  int n = state.queues.size();
+  int m;
+
+  while (true) {
+    // our own morsels first, then those of the others
+    bool found = state.queues[self].pop(m);
+    for (int k = 1; !found && k < n; k++) found = state.queues[(self + k) % n].steal(m);
+    if (!found) return;
+
+    if (state.index != NULL) scanRange(state, m);
+    else scanMorsel(state, m);
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.results[m].done = true;
+    state.finished.notify_all();
+  }
+}
+
+/*
+ * run the tasks of a scan on workers threads and print their rows:
+ * in task order if ordered, otherwise as the tasks complete.
+ */
+static RC execute(ScanState& state, int workers, bool ordered, int& count)
+{
+  int tasks = state.results.size();
+  RC rc = 0;
+
+  // deal the tasks round-robin, so that the workers move through the
+  // table together and the rows come out close to the order of the tasks
+  for (int m = 0; m < tasks; m++) state.queues[m % workers].push(m);
+
+  vector<std::thread> threads;
+  for (int w = 0; w < workers; w++) threads.push_back(std::thread(work, std::ref(state), w));
+
+  ResultSink& out = ResultSink::get();
+  vector<bool> printed(tasks, false);
+  count = 0;
+  for (int k = 0; k < tasks; k++) {
+    // the next task in order, or any completed one
+    int m = k;
+    {
+      std::unique_lock<std::mutex> lock(state.mutex);
+      while (true) {
+        if (!ordered) {
+          for (m = 0; m < tasks && (printed[m] || !state.results[m].done); m++) ;
+        }
+        if (m < tasks && state.results[m].done) break;
+        state.finished.wait(lock);
+      }
+    }
+    printed[m] = true;
+
+    MorselResult& result = state.results[m];
+    if (result.rc < 0 && rc == 0) rc = result.rc;
+    count += result.count;
+    for (size_t i = 0; rc == 0 && i < result.keys.size(); i++) {
+      out.row(state.attr, result.keys[i], result.values.c_str() + result.offsets[i]);
+    }
+
+    // free the rows once printed
+    vector<int>().swap(result.keys);
+    vector<size_t>().swap(result.offsets);
+    string().swap(result.values);
+  }
+
+  for (int w = 0; w < workers; w++) threads[w].join();
+
+  return rc;
+}
+
+RC ParallelScan::run(int attr, const Predicate& pred, const RecordFile& rf, int workers, int& count)
+{
+  const RecordId& end = rf.endRid();
+  int pages = end.pid + (end.sid > 0);
+  int morsels = (pages + MORSEL_PAGES - 1) / MORSEL_PAGES;
+
+  ScanState state(workers, morsels);
+  state.attr = attr;
+  state.pred = &pred;
+  state.rf = &rf;
+
+  return execute(state, workers, true, count);
+}
+
+RC ParallelScan::runIndex(int attr, const Predicate& pred, const RecordFile& rf,
+                          BTreeIndex& index, int workers, bool ordered, int& count)
+{
+  RC rc;
+  const KeyRange& range = pred.keys();
+  vector<int> bounds;
+
+  // a few sub-ranges per worker, so that stealing evens out the work
+  if ((rc = index.partition(range.lo, range.hi, workers * TASKS_PER_WORKER, bounds)) < 0) return rc;
+
+  // no more threads than sub-ranges
+  int threads = std::min(workers, (int) bounds.size());
+
+  ScanState state(threads, bounds.size());
+  state.attr = attr;
+  state.pred = &pred;
+  state.rf = &rf;
+  state.index = &index;
+  state.bounds.swap(bounds);
+
+  return execute(state, threads, ordered, count);
+}
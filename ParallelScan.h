@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef PARALLELSCAN_H
+#define PARALLELSCAN_H
+
+#include "Bruinbase.h"
+#include "BTreeIndex.h"
+#include "Predicate.h"
+#include "RecordFile.h"
+
+/**
+ * a full scan of a table by several threads.
+ * the pages of the table are cut into morsels of MORSEL_PAGES pages,
+ * dealt round-robin to the queues of the workers. a worker takes the
+ * morsels of its own queue from the front and, once it runs dry, steals
+ * from the back of the others', so no worker idles while another has
+ * work left. each worker evaluates the conditions on its morsels a
+ * batch at a time and keeps the count and the matching rows of each
+ * morsel to itself. the calling thread prints the rows morsel by morsel
+ * in page order as they complete, so the output is exactly that of a
+ * serial scan.
+ *
+ * an index range scan is split the same way: BTreeIndex::partition()
+ * cuts the key range into sub-ranges at separator keys of the upper
+ * levels of the tree, and each is scanned with an iterator of its own.
+ * the rows come out in key order, as from a serial index scan, or in
+ * the order the sub-ranges complete if no order is asked for.
+ *
+ * the number of threads is taken from the BRUINBASE_THREADS environment
+ * variable (the number of CPUs by default) unless setThreads() is called.
+ */
+class ParallelScan {
+ public:
+  static const int MORSEL_PAGES = 64;
+
+  // # key sub-ranges of an index scan per worker
+  static const int TASKS_PER_WORKER = 4;
+
+  /**
+   * @return the number of threads a scan may use
+   */
+  static int threads();
+
+  /**
+   * set the number of threads a scan may use.
+   * @param n[IN] the number of threads; 1 scans serially
+   */
+  static void setThreads(int n);
+
+  /**
+   * @return the number of workers worth starting for a table of the
+   *         given size: threads(), but at most one per morsel and no more
+   *         than the buffer pool has frames to pin batches for
+   */
+  static int workersFor(PageId pages);
+
+  /**
+   * scan the table and print the matching rows through ResultSink.
+   * @param attr[IN] the SELECT attribute (1: key, 2: value, 3: *, 4: COUNT(*))
+   * @param pred[IN] the compiled WHERE clause
+   * @param rf[IN] the table file, opened in 'm' or 'r' mode
+   * @param workers[IN] the number of threads to scan with
+   * @param count[OUT] the number of matching rows
+   * @return error code. 0 if no error
+   */
+  static RC run(int attr, const Predicate& pred, const RecordFile& rf, int workers, int& count);
+
+  /**
+   * scan the key range of the conditions through the index and print the
+   * matching rows through ResultSink. records are read only for their
+   * values.
+   * @param attr[IN] the SELECT attribute (1: key, 2: value, 3: *, 4: COUNT(*))
+   * @param pred[IN] the compiled WHERE clause
+   * @param rf[IN] the table file, opened in 'm' or 'r' mode
+   * @param index[IN] the index of the table
+   * @param workers[IN] the number of threads to scan with
+   * @param ordered[IN] true to print the rows in key order
+   * @param count[OUT] the number of matching rows
+   * @return error code. 0 if no error
+   */
+  static RC runIndex(int attr, const Predicate& pred, const RecordFile& rf,
+                     BTreeIndex& index, int workers, bool ordered, int& count);
+
+ private:
+  static int nthreads;  // 0 until threads() reads the environment
+};
+
+#endif // PARALLELSCAN_H
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Predicate.h"
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREDICATE_X86_SIMD 1
+#endif
+
+using std::string;
+using std::vector;
+
+bool KeyRange::excludes(int key) const
+{
+  return !excluded.empty() && std::binary_search(excluded.begin(), excluded.end(), key);
+}
+
+/*
+ * the result of a comparison with strcmp()-style difference diff.
+ * C is a template argument, so the switch is resolved at compile time.
+ */
+template <SelCond::Comparator C>
+static inline bool holds(int diff)
+{
+  switch (C) {
+  case SelCond::EQ: return diff == 0;
+  case SelCond::NE: return diff != 0;
+  case SelCond::LT: return diff < 0;
+  case SelCond::GT: return diff > 0;
+  case SelCond::LE: return diff <= 0;
+  case SelCond::GE: return diff >= 0;
+  }
+  return false;
+}
+
+template <SelCond::Comparator C>
+static bool compareValue(const char* value, size_t len, const string& constant)
+{
+  // the byte order of strcmp(), without looking for the terminator
+  int diff = memcmp(value, constant.data(), std::min(len, constant.size()));
+  if (diff == 0) diff = (len < constant.size()) ? -1 : (len > constant.size());
+  return holds<C>(diff);
+}
+
+// equality only needs a byte comparison of strings of the same length
+template <>
+bool compareValue<SelCond::EQ>(const char* value, size_t len, const string& constant)
+{
+  return len == constant.size() && memcmp(value, constant.data(), len) == 0;
+}
+
+template <>
+bool compareValue<SelCond::NE>(const char* value, size_t len, const string& constant)
+{
+  return !compareValue<SelCond::EQ>(value, len, constant);
+}
+
+/*
+ * set bit i of the selection bitmap if lo <= keys[i] <= hi.
+ * the bitmap covers n keys rounded up to a multiple of 64; the bits
+ * beyond n are cleared.
+ */
+static void selectRange(const int* keys, int n, int lo, int hi, unsigned long long* selected)
+{
+  for (int w = 0; w * 64 < n; w++) {
+    unsigned long long bits = 0;
+    int end = std::min(64, n - w * 64);
+    for (int i = 0; i < end; i++) {
+      int key = keys[w * 64 + i];
+      bits |= (unsigned long long)(key >= lo && key <= hi) << i;
+    }
+    selected[w] = bits;
+  }
+}
+
+#ifdef PREDICATE_X86_SIMD
+/*
+ * selectRange() with AVX2: 8 keys per compare. keys must be readable up
+ * to n rounded up to a multiple of 64; the extra keys are masked off.
+ */
+__attribute__((target("avx2")))
+static void selectRangeAvx2(const int* keys, int n, int lo, int hi, unsigned long long* selected)
+{
+  __m256i vlo = _mm256_set1_epi32(lo);
+  __m256i vhi = _mm256_set1_epi32(hi);
+
+  for (int w = 0; w * 64 < n; w++) {
+    unsigned long long bits = 0;
+    for (int j = 0; j < 8; j++) {
+      __m256i k = _mm256_loadu_si256((const __m256i*)(keys + w * 64 + j * 8));
+      __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(vlo, k), _mm256_cmpgt_epi32(k, vhi));
+      unsigned long long in = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff;
+      bits |= in << (j * 8);
+    }
+    if (n - w * 64 < 64) bits &= (1ULL << (n - w * 64)) - 1;
+    selected[w] = bits;
+  }
+}
+
+static const bool haveAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+int Predicate::filter(const RecordBatch& batch, unsigned long long* selected) const
+{
+  int words = (batch.count + 63) / 64;
+  int count = 0;
+
+  if (range.empty) {
+    for (int w = 0; w < words; w++) selected[w] = 0;
+    return 0;
+  }
+
+  // the key range over the whole batch
+#ifdef PREDICATE_X86_SIMD
+  if (haveAvx2) selectRangeAvx2(batch.keys, batch.count, range.lo, range.hi, selected);
+  else
+#endif
+  selectRange(batch.keys, batch.count, range.lo, range.hi, selected);
+
+  // the rest only on the rows still selected
+  for (int w = 0; w < words; w++) {
+    unsigned long long bits = selected[w];
+    if (bits != 0 && (!range.excluded.empty() || !tests.empty())) {
+      for (unsigned long long left = bits; left != 0; left &= left - 1) {
+        int i = w * 64 + __builtin_ctzll(left);
+        if (range.excludes(batch.keys[i]) ||
+            !matchesValue(batch.values[i], strlen(batch.values[i]))) {
+          bits &= ~(1ULL << (i - w * 64));
+        }
+      }
+      selected[w] = bits;
+    }
+    count += __builtin_popcountll(bits);
+  }
+
+  return count;
+}
+
+/*
+ * fold a key condition into the range.
+ * the range is marked empty if it can no longer hold a key.
+ */
+static void foldKeyCondition(SelCond::Comparator comp, int v, KeyRange& range)
+{
+  switch (comp) {
+  case SelCond::EQ:
+    range.lo = std::max(range.lo, v);
+    range.hi = std::min(range.hi, v);
+    break;
+  case SelCond::NE:
+    range.excluded.push_back(v);
+    break;
+  case SelCond::GT:
+    if (v == INT_MAX) range.empty = true;
+    else range.lo = std::max(range.lo, v + 1);
+    break;
+  case SelCond::GE:
+    range.lo = std::max(range.lo, v);
+    break;
+  case SelCond::LT:
+    if (v == INT_MIN) range.empty = true;
+    else range.hi = std::min(range.hi, v - 1);
+    break;
+  case SelCond::LE:
+    range.hi = std::min(range.hi, v);
+    break;
+  }
+}
+
+Predicate::Predicate(const vector<SelCond>& conds)
+{
+  for (unsigned i = 0; i < conds.size(); i++) {
+    switch (conds[i].attr) {
+    case 1:
+      // parse the constant once
+      foldKeyCondition(conds[i].comp, atoi(conds[i].value), range);
+      break;
+    case 2: {
+      ValueCondition c;
+      c.constant = conds[i].value;
+      switch (conds[i].comp) {
+      case SelCond::EQ: c.test = compareValue<SelCond::EQ>; break;
+      case SelCond::NE: c.test = compareValue<SelCond::NE>; break;
+      case SelCond::LT: c.test = compareValue<SelCond::LT>; break;
+      case SelCond::GT: c.test = compareValue<SelCond::GT>; break;
+      case SelCond::LE: c.test = compareValue<SelCond::LE>; break;
+      case SelCond::GE: c.test = compareValue<SelCond::GE>; break;
+      }
+      tests.push_back(c);
+      break;
+    }
+    }
+  }
+
+  if (range.lo > range.hi) range.empty = true;
+
+  // keep only the excluded keys inside the range, sorted for lookup
+  vector<int> inside;
+  for (unsigned i = 0; i < range.excluded.size(); i++) {
+    if (range.excluded[i] >= range.lo && range.excluded[i] <= range.hi) inside.push_back(range.excluded[i]);
+  }
+  std::sort(inside.begin(), inside.end());
+  inside.erase(std::unique(inside.begin(), inside.end()), inside.end());
+  range.excluded.swap(inside);
+
+  // a range of a single excluded key is empty
+  if (range.lo == range.hi && range.excludes(range.lo)) range.empty = true;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <climits>
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "SqlEngine.h"
+#include "RecordFile.h"
+
+/**
+ * the key conditions of a WHERE clause folded into one closed range
+ * [lo, hi] and a sorted list of excluded keys (the NE conditions)
+ */
+struct KeyRange {
+  int  lo;
+  int  hi;
+  std::vector<int> excluded;  // NE keys inside [lo, hi], sorted
+  bool empty;                 // true if no key can satisfy the conditions
+
+  KeyRange() : lo(INT_MIN), hi(INT_MAX), empty(false) {}
+
+  /**
+   * @return true if some condition limits the range
+   */
+  bool bounded() const { return lo != INT_MIN || hi != INT_MAX; }
+
+  /**
+   * @return true if key is one of the excluded keys
+   */
+  bool excludes(int key) const;
+
+  /**
+   * @return true if key satisfies every key condition
+   */
+  bool contains(int key) const { return key >= lo && key <= hi && !excludes(key); }
+};
+
+/**
+ * the conditions of a WHERE clause compiled for evaluation on every row.
+ * the constants are parsed once: the key conditions are folded into a
+ * KeyRange, and each value condition becomes a comparison function
+ * specialized for its comparator, so a row is tested without parsing
+ * or switching on the comparator.
+ */
+class Predicate {
+ public:
+  /**
+   * compile the conditions of a WHERE clause.
+   * @param conds[IN] the conditions, ANDed together
+   */
+  explicit Predicate(const std::vector<SelCond>& conds);
+
+  /**
+   * @return the range of keys that can satisfy the conditions
+   */
+  const KeyRange& keys() const { return range; }
+
+  /**
+   * @return true if the conditions contradict each other
+   */
+  bool empty() const { return range.empty; }
+
+  /**
+   * @return true if some condition is on the value column
+   */
+  bool hasValueConditions() const { return !tests.empty(); }
+
+  /**
+   * @return true if key satisfies the key conditions
+   */
+  bool matchesKey(int key) const { return range.contains(key); }
+
+  /**
+   * @return true if the value of length len satisfies the value conditions
+   */
+  bool matchesValue(const char* value, size_t len) const {
+    for (unsigned i = 0; i < tests.size(); i++) {
+      if (!tests[i].test(value, len, tests[i].constant)) return false;
+    }
+    return true;
+  }
+
+  /**
+   * @return true if value satisfies the value conditions
+   */
+  bool matchesValue(const std::string& value) const {
+    return matchesValue(value.data(), value.size());
+  }
+
+  /**
+   * @return true if the tuple (key, value) satisfies every condition
+   */
+  bool matches(int key, const std::string& value) const {
+    return matchesKey(key) && matchesValue(value);
+  }
+
+  /**
+   * evaluate the conditions on a batch of records at once.
+   * the key range is tested on the whole key array with vector compares
+   * (8 keys per instruction when the CPU has AVX2); the NE keys and the
+   * value conditions are then tested only on the rows still selected.
+   * @param batch[IN] the records
+   * @param selected[OUT] the selection bitmap: bit i of word i / 64 is
+   *                      set if record i satisfies every condition.
+   *                      must hold RecordBatch::CAPACITY / 64 words.
+   * @return the number of selected records
+   */
+  int filter(const RecordBatch& batch, unsigned long long* selected) const;
+
+ private:
+  typedef bool (*ValueTest)(const char* value, size_t len, const std::string& constant);
+
+  // a value condition: the comparison and the constant to compare with
+  struct ValueCondition {
+    ValueTest   test;
+    std::string constant;
+  };
+
+  KeyRange range;
+  std::vector<ValueCondition> tests;
+};
+
+#endif // PREDICATE_H
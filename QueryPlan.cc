@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "QueryPlan.h"
+#include "ParallelScan.h"
+#include <algorithm>
+#include <cmath>
+
+using std::string;
+
+const double QueryPlan::RANDOM_PAGE_COST = 4.0;
+
+QueryPlan::QueryPlan()
+{
+  method = HEAP_SCAN;
+  rows = 0;
+  cost = 0;
+  heapCost = 0;
+  exact = false;
+  workers = 1;
+  opened = false;
+}
+
+/*
+ * the expected number of distinct pages among n random reads of a table
+ * of the given number of pages (each page is read once; the buffer pool
+ * keeps it for the reads that follow).
+ */
+static double pagesTouched(double n, double pages)
+{
+  if (pages <= 0) return 0;
+  return pages * (1 - exp(-n / pages));
+}
+
+/*
+ * the estimated number of keys of [lo, hi] out of the table's keys,
+ * assuming they are spread evenly between the smallest and largest key.
+ */
+static int interpolate(const KeyRange& range, const TableCatalog& catalog)
+{
+  double lo = std::max((double) range.lo, (double) catalog.minKey);
+  double hi = std::min((double) range.hi, (double) catalog.maxKey);
+  double width = (double) catalog.maxKey - catalog.minKey + 1;
+
+  if (hi < lo) return 0;
+  return (int) ceil(catalog.rows * (hi - lo + 1) / width);
+}
+
+RC QueryPlan::choose(int attr, const Predicate& pred, const TableCatalog* catalog,
+                     const RecordFile& rf, const string& table, BTreeIndex& index)
+{
+  RC rc;
+  const KeyRange& range = pred.keys();
+  const RecordId& end = rf.endRid();
+  int tableRows = end.pid * RecordFile::RECORDS_PER_PAGE + end.sid;
+  int tablePages = end.pid + (end.sid > 0);
+
+  // only the key is needed: COUNT(*) or SELECT key without value conditions
+  bool keyOnly = (attr == 1 || attr == 4) && !pred.hasValueConditions();
+
+  opened = false;
+  exact = false;
+  rows = tableRows;
+  heapCost = tablePages;
+  workers = ParallelScan::workersFor(tablePages);
+
+  // contradictory key conditions, or a range outside the keys of the table
+  if (pred.empty() || tableRows == 0 ||
+      (catalog != NULL && (range.hi < catalog->minKey || range.lo > catalog->maxKey))) {
+    method = NO_ROWS;
+    rows = 0;
+    cost = 0;
+    workers = 1;
+    exact = true;
+    return 0;
+  }
+
+  // COUNT(*) of the whole table
+  if (catalog != NULL && attr == 4 && keyOnly && !range.bounded() && range.excluded.empty()) {
+    method = CATALOG_COUNT;
+    cost = 0;
+    workers = 1;
+    exact = true;
+    return 0;
+  }
+
+  method = HEAP_SCAN;
+  cost = heapCost;
+  if (catalog != NULL) rows = interpolate(range, *catalog);
+
+  // reading records through the index costs more than the heap scan
+  // unless some key bound narrows the range. a COUNT(*) of the whole
+  // table counts the heap too: an index left incomplete (e.g. by a
+  // failed load) must not change the row count
+  if (!range.bounded() && (!keyOnly || attr == 4)) return 0;
+  if (catalog != NULL && !catalog->hasIndex) return 0;
+  if (index.open(table + ".idx", 'm') < 0) return 0;
+  opened = true;
+
+  // the exact number of entries in the range, from the subtree counts
+  if ((rc = index.countRange(range.lo, range.hi, range.excluded, rows)) < 0) return rc;
+  exact = true;
+
+  double descent = index.height();
+  if (attr == 4 && keyOnly) {
+    method = INDEX_COUNT;
+    cost = descent * 2 * (1 + range.excluded.size());
+    workers = 1;
+    return 0;
+  }
+
+  // the leaves of the range are read in order, split among workers
+  // (see ParallelScan::runIndex()) if there are many
+  double leaves = descent - 1 + ceil((double) rows / BTLeafNode::MAX_PAIRS);
+  int leafWorkers = ParallelScan::workersFor((PageId) leaves);
+  if (keyOnly) {
+    if (leaves < heapCost) {
+      method = INDEX_ONLY_SCAN;
+      cost = leaves;
+      workers = leafWorkers;
+    }
+    return 0;
+  }
+
+  double touched = pagesTouched(rows, tablePages);
+  double fetch = leaves + RANDOM_PAGE_COST * touched;
+  if (fetch < cost) {
+    method = INDEX_SCAN;
+    cost = fetch;
+    workers = leafWorkers;
+  }
+
+  // reading the pages in order costs less per page the denser they are,
+  // plus a bitmap word per page of the table
+  double pageCost = RANDOM_PAGE_COST - (RANDOM_PAGE_COST - 1) * touched / tablePages;
+  double bitmap = leaves + pageCost * touched + (double) tablePages / PageFile::PAGE_SIZE;
+  if (bitmap < cost) {
+    method = BITMAP_SCAN;
+    cost = bitmap;
+    workers = 1;
+  }
+  return 0;
+}
+
+const char* QueryPlan::name(Method method)
+{
+  switch (method) {
+  case NO_ROWS:         return "no rows";
+  case CATALOG_COUNT:   return "catalog count";
+  case INDEX_COUNT:     return "index count";
+  case INDEX_ONLY_SCAN: return "index-only scan";
+  case INDEX_SCAN:      return "index scan";
+  case BITMAP_SCAN:     return "bitmap heap scan";
+  case HEAP_SCAN:       return "heap scan";
+  }
+  return "unknown";
+}
+
+void QueryPlan::log(FILE* stream) const
+{
+  fprintf(stream, "  -- plan: %s", name(method));
+  if (workers > 1) fprintf(stream, " (%d workers)", workers);
+  fprintf(stream, ", %s%d rows, est. %.0f pages (heap scan %.0f pages)\n",
+          exact ? "" : "est. ", rows, cost, heapCost);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef QUERYPLAN_H
+#define QUERYPLAN_H
+
+#include <cstdio>
+#include <string>
+#include "Bruinbase.h"
+#include "BTreeIndex.h"
+#include "Predicate.h"
+#include "RecordFile.h"
+#include "TableCatalog.h"
+
+/**
+ * the access path chosen for a SELECT.
+ * the number of rows in the key range is counted exactly from the
+ * subtree counts of the index (a few page reads), or interpolated
+ * between the key min/max of the catalog without an index. the cost of
+ * each possible path is estimated in page reads, a random read costing
+ * RANDOM_PAGE_COST sequential ones, and the cheapest path is chosen:
+ *
+ *  - NO_ROWS:         no key can match; nothing is read
+ *  - CATALOG_COUNT:   COUNT(*) of the whole table, from the catalog
+ *  - INDEX_COUNT:     COUNT(*) from the subtree counts of the index
+ *  - INDEX_ONLY_SCAN: the leaves in the key range; no record is read.
+ *                     a wide range is split among workers
+ *  - INDEX_SCAN:      the leaves in the key range and one random record
+ *                     read per entry
+ *  - BITMAP_SCAN:     the leaves in the key range, then the heap pages
+ *                     holding their records, each once and in pid order.
+ *                     the closer together the pages, the closer a read is
+ *                     to a sequential one
+ *  - HEAP_SCAN:       every record of the table, in order, split among
+ *                     workers (see ParallelScan) if the table is large
+ */
+class QueryPlan {
+ public:
+  enum Method { NO_ROWS, CATALOG_COUNT, INDEX_COUNT, INDEX_ONLY_SCAN, INDEX_SCAN, BITMAP_SCAN, HEAP_SCAN };
+
+  // the cost of a random page read relative to a sequential one
+  static const double RANDOM_PAGE_COST;
+
+  Method method;    // the chosen access path
+  int    rows;      // the estimated # rows in the key range
+  double cost;      // the estimated cost of the chosen path
+  double heapCost;  // the estimated cost of a heap scan
+  bool   exact;     // true if rows was counted, not estimated
+  int    workers;   // the # threads of a HEAP_SCAN, INDEX_SCAN or INDEX_ONLY_SCAN
+
+  QueryPlan();
+
+  /**
+   * choose the access path of a SELECT. the index of the table is opened
+   * in index if some index plan may be chosen; the caller closes it.
+   * @param attr[IN] the SELECT attribute (1: key, 2: value, 3: *, 4: COUNT(*))
+   * @param pred[IN] the compiled WHERE clause
+   * @param catalog[IN] the statistics of the table, or NULL if unknown
+   * @param rf[IN] the table file
+   * @param table[IN] the name of the table
+   * @param index[OUT] the index of the table, opened if indexOpen()
+   * @return error code. 0 if no error
+   */
+  RC choose(int attr, const Predicate& pred, const TableCatalog* catalog,
+            const RecordFile& rf, const std::string& table, BTreeIndex& index);
+
+  /**
+   * @return true if choose() opened the index
+   */
+  bool indexOpen() const { return opened; }
+
+  /**
+   * @return the name of an access path
+   */
+  static const char* name(Method method);
+
+  /**
+   * write the plan to a stream, one line.
+   * @param stream[IN] the stream to write to
+   */
+  void log(FILE* stream) const;
+
+ private:
+  bool opened;  // true if the index was opened
+};
+
+#endif // QUERYPLAN_H
@@ -9,7 +9,9 @@
 
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include "BufferPool.h"
 #include <cstring>
+#include <algorithm>
 
 using std::string;
 
@@ -24,7 +26,7 @@ static char* slotPtr(char* page, int n);
 static void readSlot(const char* page, int n, int& key, std::string& value);
 
 // write the record to the n'th slot in the page
-static void writeSlot(char* page, int n, int key, const std::string& value);
+static void writeSlot(char* page, int n, int key, std::string_view value);
 
 // get # records stored in the page
 static int getRecordCount(const char* page);
@@ -32,6 +34,9 @@ static int getRecordCount(const char* page);
 // update # records stored in the page
 static void setRecordCount(char* page, int count);
 
+// the most pages a batch may keep pinned
+static int pinLimit(const PageFile& pf);
+
 
 //
 // helper functions for RecordId manipulation
@@ -168,46 +173,146 @@ RC RecordFile::close()
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PinnedPage page;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
   if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record
+  if ((rc = pf.pin(rid.pid, page)) < 0) return rc;
+
+  // read the record directly from the cached page
+  readSlot(page.data(), rid.sid, key, value);
+
+  return 0;
+}
+
+RC RecordFile::readBatch(RecordId& rid, RecordBatch& batch) const
+{
+  return readBatch(rid, erid, batch);
+}
+
+RC RecordFile::readBatch(RecordId& rid, const RecordId& end, RecordBatch& batch) const
+{
+  RC rc;
+  RecordId stop = std::min(end, erid);
+  int limit = pinLimit(pf);
+
+  batch.release();
+  batch.count = 0;
+  batch.first = rid;
+
+  if (rid.pid < 0 || rid.sid < 0 || rid.sid >= RECORDS_PER_PAGE) return RC_INVALID_RID;
+
+  while (batch.count < RecordBatch::CAPACITY && batch.npages < limit && rid < stop) {
+    // fetch the next run of pages with a single read, unless the pool
+    // is too small to keep them until they are used
+    if (rid.sid == 0 && rid.pid % PageFile::MAX_RANGE == 0 && limit >= PageFile::MAX_RANGE) {
+      pf.prefetch(rid.pid, PageFile::MAX_RANGE);
+    }
+
+    PinnedPage& page = batch.pages[batch.npages];
+    if ((rc = pf.pin(rid.pid, page)) < 0) return rc;
+    batch.npages++;
+
+    // take the rest of the page, up to the end of the file or the batch
+    int last = (rid.pid == stop.pid) ? stop.sid : RECORDS_PER_PAGE;
+    int n = std::min(last - rid.sid, RecordBatch::CAPACITY - batch.count);
+
+    for (int i = 0; i < n; i++) {
+      const char* ptr = slotPtr(page.data(), rid.sid + i);
+      memcpy(&batch.keys[batch.count], ptr, sizeof(int));
+      batch.values[batch.count] = ptr + sizeof(int);
+      batch.count++;
+    }
+
+    rid.sid += n;
+    if (rid.sid >= RECORDS_PER_PAGE) {
+      rid.pid++;
+      rid.sid = 0;
+    }
+  }
 
-  // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  return 0;
+}
+
+RC RecordFile::readBitmap(const RidBitmap& bitmap, PageId& pid, RecordBatch& batch) const
+{
+  RC rc;
+  PageId end = std::min(bitmap.pages(), erid.pid + (erid.sid > 0));
+  int limit = pinLimit(pf);
+
+  batch.release();
+  batch.count = 0;
+  batch.first.pid = pid;
+  batch.first.sid = 0;
+
+  // stop before a page could overflow the batch
+  while (pid < end && batch.npages < limit &&
+         batch.count + RECORDS_PER_PAGE <= RecordBatch::CAPACITY) {
+    unsigned slots = bitmap.page(pid);
+    if (slots == 0) {
+      pid++;
+      continue;
+    }
+
+    PinnedPage& page = batch.pages[batch.npages];
+    if ((rc = pf.pin(pid, page)) < 0) return rc;
+    batch.npages++;
+
+    // skip the slots past the records of the page
+    int records = getRecordCount(page.data());
+    if (records < RECORDS_PER_PAGE) slots &= (1u << std::max(records, 0)) - 1;
+
+    for (; slots != 0; slots &= slots - 1) {
+      const char* ptr = slotPtr(page.data(), __builtin_ctz(slots));
+      memcpy(&batch.keys[batch.count], ptr, sizeof(int));
+      batch.values[batch.count] = ptr + sizeof(int);
+      batch.count++;
+    }
+    pid++;
+  }
 
   return 0;
 }
 
-RC RecordFile::append(int key, const std::string& value, RecordId& rid)
+void RecordBatch::release()
+{
+  for (int i = 0; i < npages; i++) pages[i].release();
+  npages = 0;
+}
+
+RC RecordFile::append(int key, std::string_view value, RecordId& rid)
 {
   RC   rc;
   char page[PageFile::PAGE_SIZE];
 
   // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
+  // we modify the cached tail page in place
   if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
+    PinnedPage tail;
+    if ((rc = pf.pin(erid.pid, tail)) < 0) return rc;
+
+    // write the record to the first empty slot and update
+    // # records stored in the first four bytes of the page
+    writeSlot(tail.data(), erid.sid, key, value);
+    setRecordCount(tail.data(), erid.sid + 1);
+
+    // releasing the dirty page writes it to the disk
+    tail.markDirty();
+    if ((rc = tail.release()) < 0) return rc;
   } else {
     // if this is the first slot of an empty page
     // we can simply initialize the page with zeros
     memset(page, 0, PageFile::PAGE_SIZE);
-  }
-    
-  // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
+    writeSlot(page, erid.sid, key, value);
+    setRecordCount(page, erid.sid + 1);
 
-  // the first four bytes in the page stores # records in the page.
-  // update this number.
-  setRecordCount(page, erid.sid + 1);
-
-  // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+    // write the page to the disk
+    if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+  }
     
   // we need to output the rid of the record slot
   rid = erid;
@@ -218,6 +323,49 @@ RC RecordFile::append(int key, const std::string& value, RecordId& rid)
   return 0;
 }
 
+RC RecordFile::appendBatch(const Row* rows, int n, RecordId* rids)
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+  int  i = 0;
+
+  // fill the free slots of the tail page in place, and write it once
+  if (erid.sid > 0 && n > 0) {
+    PinnedPage tail;
+    if ((rc = pf.pin(erid.pid, tail)) < 0) return rc;
+
+    int count = std::min(n, RECORDS_PER_PAGE - erid.sid);
+    for (; i < count; i++) writeSlot(tail.data(), erid.sid + i, rows[i].key, rows[i].value);
+    setRecordCount(tail.data(), erid.sid + count);
+
+    tail.markDirty();
+    if ((rc = tail.release()) < 0) return rc;
+
+    for (int j = 0; j < count; j++) {
+      if (rids != NULL) rids[j] = erid;
+      ++erid;
+    }
+  }
+
+  // build each of the remaining pages in memory and write it whole
+  while (i < n) {
+    int count = (n - i < RECORDS_PER_PAGE) ? n - i : RECORDS_PER_PAGE;
+
+    memset(page, 0, PageFile::PAGE_SIZE);
+    for (int j = 0; j < count; j++) writeSlot(page, j, rows[i + j].key, rows[i + j].value);
+    setRecordCount(page, count);
+
+    if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+
+    for (int j = 0; j < count; j++, i++) {
+      if (rids != NULL) rids[i] = erid;
+      ++erid;
+    }
+  }
+
+  return 0;
+}
+
 const RecordId& RecordFile::endRid() const
 {
   return erid;
@@ -238,6 +386,16 @@ static void setRecordCount(char* page, int count)
   memcpy(page, &count, sizeof(int));
 }
 
+static int pinLimit(const PageFile& pf)
+{
+  int most = RecordBatch::MAX_PAGES;
+
+  // a mapped page takes no frame. otherwise leave half of the buffer
+  // pool to the other pages in use, so that a small pool still works
+  if (pf.mapped()) return most;
+  return std::max(1, std::min(most, BufferPool::get().frameCount() / 2));
+}
+
 static char* slotPtr(char* page, int n) 
 {
   // compute the location of the n'th slot in a page.
@@ -259,7 +417,7 @@ static void readSlot(const char* page, int n, int& key, std::string& value)
   value.assign(ptr + sizeof(int));
 }
 
-static void writeSlot(char* page, int n, int key, const std::string& value)
+static void writeSlot(char* page, int n, int key, std::string_view value)
 {
   // compute the location of the record
   char *ptr = slotPtr(page, n);
@@ -270,9 +428,10 @@ static void writeSlot(char* page, int n, int key, const std::string& value)
   // store the value. 
   if ((int)value.size() >= RecordFile::MAX_VALUE_LENGTH) {
     // when the string is longer than MAX_VALUE_LENGTH, truncate it.
-    memcpy(ptr + sizeof(int), value.c_str(), RecordFile::MAX_VALUE_LENGTH -1);
+    memcpy(ptr + sizeof(int), value.data(), RecordFile::MAX_VALUE_LENGTH -1);
     *(ptr + sizeof(int) + RecordFile::MAX_VALUE_LENGTH - 1) = 0;
   } else {
-    strcpy(ptr + sizeof(int), value.c_str());
+    memcpy(ptr + sizeof(int), value.data(), value.size());
+    *(ptr + sizeof(int) + value.size()) = 0;
   }
 }
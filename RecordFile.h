@@ -11,6 +11,8 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <string_view>
+#include <vector>
 #include "PageFile.h"
 
 /**
@@ -38,6 +40,17 @@ bool operator<= (const RecordId& r1, const RecordId& r2);
 bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
+/**
+ * a record to append with RecordFile::appendBatch()
+ */
+typedef struct {
+  int               key;
+  std::string_view  value;
+} Row;
+
+class RecordBatch;
+class RidBitmap;
+
 /**
  * read/write a record to a file
  */
@@ -59,11 +72,26 @@ class RecordFile {
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for memory-mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& filename, char mode);
 
+  /**
+   * tell the kernel how the records will be accessed ('m' mode only).
+   * @param access[IN] the expected access pattern
+   * @return error code. 0 if no error
+   */
+  RC advise(PageFile::Access access) { return pf.advise(access); }
+
+  /**
+   * load the pages of a sequential scan ahead of use.
+   * @param pid[IN] the first page to load
+   * @param count[IN] the number of pages to load
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count) const { return pf.prefetch(pid, count); }
+
   /**
    * close the file.
    * @return error code. 0 if no error
@@ -79,6 +107,44 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read a vector of consecutive records starting at rid.
+   * the keys are copied into the batch; the values stay in the pages,
+   * which remain pinned until the next readBatch() into the same batch.
+   * runs of pages are prefetched as the scan reaches them.
+   * @param rid[IN/OUT] the first record to read; on return, the record
+   *                    following the last one read
+   * @param batch[OUT] the records read. batch.count is 0 at the end of the file
+   * @return error code. 0 if no error
+   */
+  RC readBatch(RecordId& rid, RecordBatch& batch) const;
+
+  /**
+   * read a vector of consecutive records as readBatch(rid, batch) does,
+   * stopping before end. threads may read disjoint ranges of the same
+   * file at once, each into its own batch.
+   * @param rid[IN/OUT] the first record to read; on return, the record
+   *                    following the last one read
+   * @param end[IN] the record to stop at
+   * @param batch[OUT] the records read. batch.count is 0 once rid
+   *                   reaches end or the end of the file
+   * @return error code. 0 if no error
+   */
+  RC readBatch(RecordId& rid, const RecordId& end, RecordBatch& batch) const;
+
+  /**
+   * read the records marked in a bitmap, page by page in pid order.
+   * every page with a marked record is read once, no matter how many of
+   * its records are marked. the batch is filled as by readBatch(), except
+   * that its records are not consecutive.
+   * @param bitmap[IN] the records to read
+   * @param pid[IN/OUT] the page to start at; on return, the page
+   *                    following the last one read
+   * @param batch[OUT] the records read. batch.count is 0 at the end of the bitmap
+   * @return error code. 0 if no error
+   */
+  RC readBitmap(const RidBitmap& bitmap, PageId& pid, RecordBatch& batch) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -88,7 +154,19 @@ class RecordFile {
    * @param rid[OUT] the location of the stored record
    * @return error code. 0 if no error
    */
-  RC append(int key, const std::string& value, RecordId& rid);
+  RC append(int key, std::string_view value, RecordId& rid);
+
+  /**
+   * append n records at the end of the file, as n calls of append() do.
+   * the pages are filled in memory and each is written once: the rest of
+   * a partly filled tail page in place, the others whole.
+   * @param rows[IN] the records to append
+   * @param n[IN] the number of records
+   * @param rids[OUT] the locations of the stored records, or NULL.
+   *                  on an error, the records before endRid() are stored
+   * @return error code. 0 if no error
+   */
+  RC appendBatch(const Row* rows, int n, RecordId* rids);
 
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
@@ -101,4 +179,75 @@ class RecordFile {
   RecordId erid;   // the last record id of the file + 1
 };
 
+/**
+ * a vector of up to CAPACITY consecutive records read by
+ * RecordFile::readBatch(). the keys are gathered into one array so they
+ * can be compared several at a time; values[i] points at the value of
+ * record i inside its pinned page.
+ */
+class RecordBatch {
+ public:
+  static const int CAPACITY = 1024;
+
+  // the most pages a batch keeps pinned. a batch may start and end in
+  // the middle of a page. with a small buffer pool, a batch pins at
+  // most half of its frames and holds fewer records
+  static const int MAX_PAGES = CAPACITY / RecordFile::RECORDS_PER_PAGE + 2;
+
+  RecordBatch() : count(0), npages(0) { first.pid = first.sid = 0; }
+
+  /**
+   * unpin the pages of the batch. the values become invalid.
+   */
+  void release();
+
+  int         count;              // the number of records in the batch
+  RecordId    first;              // the id of record 0; the rest follow it
+                                  // unless read by readBitmap()
+  int         keys[CAPACITY];
+  const char* values[CAPACITY];
+
+ private:
+  friend class RecordFile;
+
+  PinnedPage  pages[MAX_PAGES];   // the pages holding the values
+  int         npages;
+
+  // the pinned pages must not be shared
+  RecordBatch(const RecordBatch&);
+  RecordBatch& operator=(const RecordBatch&);
+};
+
+/**
+ * a set of RecordIds of a RecordFile, one word of slot bits per page.
+ * collecting the RecordIds found through an index here and reading them
+ * with RecordFile::readBitmap() visits each heap page once, in file
+ * order, instead of once per record in key order.
+ */
+class RidBitmap {
+ public:
+  /**
+   * @param pages[IN] the number of pages of the RecordFile
+   */
+  explicit RidBitmap(PageId pages) : slots(pages, 0) {}
+
+  /**
+   * add a record to the set.
+   */
+  void set(const RecordId& rid) { slots[rid.pid] |= 1u << rid.sid; }
+
+  /**
+   * @return the slot bits of page pid: bit i is set if record (pid, i) is in the set
+   */
+  unsigned page(PageId pid) const { return slots[pid]; }
+
+  /**
+   * @return the number of pages covered
+   */
+  PageId pages() const { return slots.size(); }
+
+ private:
+  std::vector<unsigned> slots;  // RECORDS_PER_PAGE fits in a word
+};
+
 #endif // RECORDFILE_H
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "ResultSink.h"
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+ResultSink* ResultSink::sink = NULL;
+
+ResultSink& ResultSink::get()
+{
+  if (sink != NULL) return *sink;
+
+  Format format = TEXT;
+  const char* s = getenv("BRUINBASE_OUTPUT_FORMAT");
+  if (s != NULL && parseFormat(s, format) < 0) {
+    fprintf(stderr, "Warning: unknown output format %s, using text\n", s);
+    format = TEXT;
+  }
+
+  sink = new ResultSink(stdout, format);
+  return *sink;
+}
+
+ResultSink::ResultSink(FILE* s, Format format)
+{
+  stream = s;
+  fmt = format;
+  used = 0;
+}
+
+RC ResultSink::parseFormat(const char* name, Format& format)
+{
+  if (strcasecmp(name, "text") == 0) format = TEXT;
+  else if (strcasecmp(name, "tsv") == 0) format = TSV;
+  else if (strcasecmp(name, "binary") == 0) format = BINARY;
+  else return RC_INVALID_ATTRIBUTE;
+  return 0;
+}
+
+void ResultSink::row(int attr, int key, const char* value)
+{
+  switch (fmt) {
+  case TEXT:
+    if (attr == 1 || attr == 3) putInt(key);
+    if (attr == 3) put(" '", 2);
+    if (attr == 2 || attr == 3) put(value, strlen(value));
+    if (attr == 3) putChar('\'');
+    putChar('\n');
+    break;
+
+  case TSV:
+    if (attr == 1 || attr == 3) putInt(key);
+    if (attr == 3) putChar('\t');
+    if (attr == 2 || attr == 3) putValue(value);
+    putChar('\n');
+    break;
+
+  case BINARY:
+    if (attr == 1 || attr == 3) putBinaryInt(key);
+    if (attr == 2 || attr == 3) {
+      unsigned short len = strlen(value);
+      put((const char*) &len, sizeof(len));
+      put(value, len);
+    }
+    break;
+  }
+}
+
+void ResultSink::count(int count)
+{
+  if (fmt == BINARY) {
+    putBinaryInt(count);
+  } else {
+    putInt(count);
+    putChar('\n');
+  }
+}
+
+void ResultSink::prompt()
+{
+  if (fmt != BINARY) put("Bruinbase> ", 11);
+  flush();
+}
+
+RC ResultSink::flush()
+{
+  RC rc = 0;
+
+  if (used > 0 && fwrite(buffer, 1, used, stream) != (size_t) used) rc = RC_FILE_WRITE_FAILED;
+  used = 0;
+  if (fflush(stream) != 0) rc = RC_FILE_WRITE_FAILED;
+
+  return rc;
+}
+
+void ResultSink::put(const char* s, int n)
+{
+  // a string longer than the buffer goes out directly
+  if (n > BUFFER_SIZE) {
+    flush();
+    fwrite(s, 1, n, stream);
+    return;
+  }
+
+  reserve(n);
+  memcpy(buffer + used, s, n);
+  used += n;
+}
+
+void ResultSink::putInt(int n)
+{
+  char digits[12];
+  int  i = sizeof(digits);
+
+  // work on the magnitude as unsigned so that INT_MIN needs no special case
+  unsigned int u = (n < 0) ? 0u - (unsigned int) n : (unsigned int) n;
+  do {
+    digits[--i] = '0' + u % 10;
+    u /= 10;
+  } while (u != 0);
+  if (n < 0) digits[--i] = '-';
+
+  put(digits + i, sizeof(digits) - i);
+}
+
+void ResultSink::putBinaryInt(int n)
+{
+  put((const char*) &n, sizeof(n));
+}
+
+void ResultSink::putValue(const char* value)
+{
+  for (const char* p = value; *p != 0; p++) {
+    switch (*p) {
+    case '\t': put("\\t", 2); break;
+    case '\n': put("\\n", 2); break;
+    case '\\': put("\\\\", 2); break;
+    default:   putChar(*p); break;
+    }
+  }
+}
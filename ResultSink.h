@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef RESULTSINK_H
+#define RESULTSINK_H
+
+#include <cstdio>
+#include "Bruinbase.h"
+
+/**
+ * the buffered writer of query results.
+ * rows are formatted into a large buffer with a hand-rolled integer
+ * formatter and written to the output stream in big chunks, instead of
+ * one fprintf() per row. the output format is chosen once per session
+ * from the BRUINBASE_OUTPUT_FORMAT environment variable unless
+ * setFormat() is called:
+ *
+ *  - TEXT:   the classic output. 'key', 'value' or "key 'value'" per line
+ *  - TSV:    tab separated key and value per line. tab, newline and
+ *            backslash in a value are escaped as \t, \n and \\
+ *  - BINARY: for piping into other programs. a key is a 4-byte integer
+ *            in host byte order; a value is a 2-byte length in host byte
+ *            order followed by that many bytes. a row is its key and/or
+ *            value, and COUNT(*) is a 4-byte integer. no prompt is printed.
+ */
+class ResultSink {
+ public:
+  enum Format { TEXT, TSV, BINARY };
+
+  static const int BUFFER_SIZE = 65536;
+
+  /**
+   * @return the result writer of the session, writing to stdout
+   */
+  static ResultSink& get();
+
+  /**
+   * convert a format name (text, tsv or binary) to a Format.
+   * @param name[IN] the name of the format
+   * @param format[OUT] the format
+   * @return 0 if no error. RC_INVALID_ATTRIBUTE if the name is unknown.
+   */
+  static RC parseFormat(const char* name, Format& format);
+
+  /**
+   * @return the output format
+   */
+  Format format() const { return fmt; }
+
+  /**
+   * set the output format of the following results.
+   * @param format[IN] the format
+   */
+  void setFormat(Format format) { fmt = format; }
+
+  /**
+   * write a result row.
+   * @param attr[IN] the SELECT attribute (1: key, 2: value, 3: *)
+   * @param key[IN] the key of the row
+   * @param value[IN] the value of the row, NUL terminated
+   */
+  void row(int attr, int key, const char* value);
+
+  /**
+   * write the result of SELECT COUNT(*).
+   * @param count[IN] the number of matching rows
+   */
+  void count(int count);
+
+  /**
+   * write the command prompt (not in BINARY format) and flush.
+   */
+  void prompt();
+
+  /**
+   * write the buffered output to the stream.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+ private:
+  ResultSink(FILE* stream, Format format);
+
+  // make room for n bytes in the buffer
+  void reserve(int n) { if (used + n > BUFFER_SIZE) flush(); }
+
+  void put(const char* s, int n);
+  void putChar(char c) { reserve(1); buffer[used++] = c; }
+  void putInt(int n);
+  void putBinaryInt(int n);
+  void putValue(const char* value);
+
+  static ResultSink* sink;
+
+  FILE*  stream;                 // the output stream
+  Format fmt;                    // the output format
+  int    used;                   // # bytes used in buffer
+  char   buffer[BUFFER_SIZE];
+};
+
+#endif // RESULTSINK_H
@@ -11,12 +11,24 @@
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <algorithm>
+#include <ctime>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeNode.h"
 #include "BTreeIndex.h"
+#include "Predicate.h"
+#include "ResultSink.h"
+#include "TableCatalog.h"
+#include "QueryPlan.h"
+#include "ParallelScan.h"
+#include "LoadFile.h"
+#include "LoadPipeline.h"
+#include "IndexSorter.h"
+#include <chrono>
+#include <thread>
 
 using namespace std;
 
@@ -24,10 +36,12 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+// # index entries fetched at a time by an index scan
+static const int INDEX_BATCH = 64;
 
 RC SqlEngine::run(FILE* commandline)
 {
-  fprintf(stdout, "Bruinbase> ");
+  ResultSink::get().prompt();
 
    // BTLeafNode node;
    // string filename = "movie.del";
@@ -162,6 +176,88 @@ RC SqlEngine::run(FILE* commandline)
 
 
 
+/*
+ * the rows of a bitmap heap scan, gathered to be put back in key order.
+ * the values are copied out of their pages, which are released batch by
+ * batch. rows of equal keys keep the pid order they were read in.
+ */
+struct BitmapRow {
+  int    key;
+  string value;
+};
+
+static bool bitmapRowLess(const BitmapRow& a, const BitmapRow& b)
+{
+  return a.key < b.key;
+}
+
+/*
+ * run a bitmap heap scan: collect the RecordIds of the key range from the
+ * index, then read the heap pages holding them once each, in pid order,
+ * and evaluate the rest of the conditions a batch at a time. rows are
+ * printed in key order, like an index scan; COUNT(*) needs no sort.
+ */
+static RC bitmapScan(int attr, const Predicate& pred, const RecordFile& rf,
+                     BTreeIndex& index, int& count)
+{
+  RC rc;
+  const KeyRange& range = pred.keys();
+  const RecordId& end = rf.endRid();
+  RidBitmap bitmap(end.pid + (end.sid > 0));
+  BTreeIndex::Iterator it;
+  IndexEntry entries[INDEX_BATCH];
+  int n;
+
+  rc = index.seekRange(range.lo, range.hi, it);
+  if (rc < 0 && rc != RC_NO_SUCH_RECORD) return rc;
+
+  while ((n = it.next(entries, INDEX_BATCH)) > 0) {
+    for (int e = 0; e < n; e++) {
+      if (range.excludes(entries[e].key)) continue;
+
+      // an index left over from a larger table may point past its end
+      const RecordId& rid = entries[e].rid;
+      if (rid.pid < 0 || rid.pid >= bitmap.pages() ||
+          rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+      bitmap.set(rid);
+    }
+  }
+  if (n < 0) return n;
+
+  RecordBatch batch;
+  unsigned long long selected[RecordBatch::CAPACITY / 64];
+  vector<BitmapRow> rows;
+  PageId pid = 0;
+
+  count = 0;
+  while (true) {
+    if ((rc = rf.readBitmap(bitmap, pid, batch)) < 0) return rc;
+    if (batch.count == 0) break;
+
+    int matched = pred.filter(batch, selected);
+    count += matched;
+    if (attr == 4 || matched == 0) continue;
+
+    for (int w = 0; w * 64 < batch.count; w++) {
+      for (unsigned long long bits = selected[w]; bits != 0; bits &= bits - 1) {
+        int i = w * 64 + __builtin_ctzll(bits);
+        BitmapRow row;
+        row.key = batch.keys[i];
+        rows.push_back(row);
+        if (attr != 1) rows.back().value = batch.values[i];
+      }
+    }
+  }
+
+  // back to key order
+  stable_sort(rows.begin(), rows.end(), bitmapRowLess);
+
+  ResultSink& out = ResultSink::get();
+  for (size_t i = 0; i < rows.size(); i++) out.row(attr, rows[i].key, rows[i].value.c_str());
+
+  return 0;
+}
+
 RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 {
   RecordFile rf;   // RecordFile containing the table
@@ -170,102 +266,68 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   RC     rc;
   int    key;     
   string value;
-  int    count;
-  int    diff;
+  int    count = 0;
+
+  ResultSink& out = ResultSink::get();
 
   BTreeIndex index;
-  IndexCursor cursor;
-  bool need_index = true;
-  bool NE_exists = false;
+  BTreeIndex::Iterator it;
+  IndexEntry entries[INDEX_BATCH];
+  int n;
+  TableCatalog catalog;
+  QueryPlan plan;
 
-  vector<SelCond> key_constraints;
-  vector<SelCond> value_constraints;
+  // parse the conditions once and fold the key conditions into a range
+  Predicate pred(cond);
+  const KeyRange& range = pred.keys();
 
   // open the table file
-  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+  if ((rc = rf.open(table + ".tbl", 'm')) < 0) {
     fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
     return rc;
   }
 
-  // Sort WHERE conditions into key and value constraints
-  for (unsigned i = 0; i < cond.size(); i++)
-  {
-    switch(cond[i].attr)
-    {
-      case 1:
-        if (cond[i].comp != SelCond::NE) key_constraints.push_back(cond[i]);
-        else NE_exists = true;
-        break;
-      case 2:
-        value_constraints.push_back(cond[i]);
-        break;
-    }
+  // choose the access path from the statistics of the last load, unless
+  // the table changed since
+  if (catalog.read(table) < 0 || !catalog.matches(rf)) {
+    rc = plan.choose(attr, pred, NULL, rf, table, index);
+  } else {
+    rc = plan.choose(attr, pred, &catalog, rf, table, index);
   }
-  // TODO: Do not use index for SelCond::NE if thats the only thing that is in key constraints
-
+  if (rc < 0) {
+    fprintf(stderr, "Error: while planning the query on table %s\n", table.c_str());
+    goto exit_select;
+  }
+  plan.log(stderr);
 
+  // the heap is read in order unless records are fetched one by one
+  rf.advise(plan.method == QueryPlan::INDEX_SCAN ? PageFile::RANDOM : PageFile::SEQUENTIAL);
 
-  // need_index = FALSE for following conditions:
-  if ( ((attr == 2 || attr == 3) && key_constraints.empty()) || attr == 4 && key_constraints.empty() && !value_constraints.empty() )
+  // the count is known from the plan
+  if (plan.method == QueryPlan::NO_ROWS ||
+      plan.method == QueryPlan::CATALOG_COUNT ||
+      plan.method == QueryPlan::INDEX_COUNT)
   {
-    need_index = false;
+    count = plan.rows;
   }
 
-  if (NE_exists)
+  // a wide key range is scanned by several threads. COUNT(*) prints no
+  // rows and SELECT key prints them as the sub-ranges complete (without
+  // ORDER BY no order is promised); other rows come out in key order.
+  else if ((plan.method == QueryPlan::INDEX_SCAN || plan.method == QueryPlan::INDEX_ONLY_SCAN) &&
+           plan.workers > 1)
   {
-    if (key_constraints.empty()) need_index = false;
-    else
-    {
-      for (unsigned i = 0; i < cond.size(); i++)
-      {
-        if (cond[i].attr == 1 && cond[i].comp == SelCond::NE)
-        {
-          key_constraints.push_back(cond[i]);
-        }
-      }
+    bool ordered = (attr != 1 && attr != 4);
+    if ((rc = ParallelScan::runIndex(attr, pred, rf, index, plan.workers, ordered, count)) < 0) {
+      fprintf(stderr, "Error: while reading the index of table %s\n", table.c_str());
+      goto exit_select;
     }
   }
 
-  // attempt to open index file
-  if (need_index && (rc = index.open(table + ".idx", 'r')) < 0)
+  // if using index, scan the key range
+  else if (plan.method == QueryPlan::INDEX_SCAN || plan.method == QueryPlan::INDEX_ONLY_SCAN)
   {
-    need_index = false;
-  }
-
-
-
-
-  //need_index = false;
-
-  // if using index, find the starting location and point IndexCursor at it
-  if (need_index)
-  {
-    if (key_constraints.size() > 0)
-    {
-      // find the EQ, GT, or GE conditionSE
-      for (int i = 0; i < key_constraints.size(); i++)
-      {
-        if (key_constraints[i].comp == SelCond::EQ ||
-            key_constraints[i].comp == SelCond::GE)
-        {
-          rc = index.locate(atoi(key_constraints[i].value), cursor);
-          break;
-        }
-        else if (key_constraints[i].comp == SelCond::GT)
-        {
-          rc = index.locate(atoi(key_constraints[i].value) + 1, cursor);
-          break;
-        }
-        else
-        {
-          rc = index.locate(0, cursor);
-        }
-      }
-    }
-    else
-    {
-      rc = index.locate(0, cursor);
-    }
+    rc = index.seekRange(range.lo, range.hi, it);
 
     if (rc != RC_NO_SUCH_RECORD && rc != 0)
     {
@@ -275,162 +337,81 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 
     count = 0;
 
-
-    // Then start reading from that location to the max value if in key constraints
-    while (index.readForward(cursor, key, rid) != -3)
+    // fetch the entries a batch at a time from the pinned leaves
+    while ((n = it.next(entries, INDEX_BATCH)) > 0)
     {
-      // only read from RecordFile if we need the value constraint
-      if ( (attr == 1 && !value_constraints.empty()) || attr == 2 || attr == 3 || (attr == 4 && !value_constraints.empty()))
+      for (int e = 0; e < n; e++)
       {
-        // read the tuple
-        if ((rc = rf.read(rid, key, value)) < 0) {
-          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-          goto exit_select;
-        }
-      }
+        key = entries[e].key;
+        rid = entries[e].rid;
 
-      for (unsigned i = 0; i < key_constraints.size(); i++)
-      {
-        diff = key - atoi(key_constraints[i].value);
+        // the iterator stays within [lo, hi]; only NE is left to check
+        if (range.excludes(key)) continue;
 
-        switch (key_constraints[i].comp)
+        // only read from RecordFile if we need the value constraint
+        if (attr == 2 || attr == 3 || pred.hasValueConditions())
         {
-          case SelCond::EQ:
-            if (diff != 0) goto exit_select;
-            break;
-          case SelCond::NE:
-            if (diff == 0) goto next_node;
-            break;
-          case SelCond::GT:
-            if (diff <= 0) goto next_node;
-            break;
-          case SelCond::LT:
-            if (diff >= 0) goto exit_select;
-            break;
-          case SelCond::GE:
-            if (diff < 0) goto next_node;
-            break;
-          case SelCond::LE:
-            if (diff > 0) goto exit_select;
-            break;
-
+          // read the tuple
+          if ((rc = rf.read(rid, key, value)) < 0) {
+            fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+            goto exit_select;
+          }
         }
-      }
 
-      for (unsigned i = 0; i < value_constraints.size(); i++)
-      {
-        diff = strcmp(value.c_str(), value_constraints[i].value);
+        if (!pred.matchesValue(value)) continue;
 
-        switch (value_constraints[i].comp)
-        {
-          case SelCond::EQ:
-            if (diff != 0) goto next_node;
-            break;
-          case SelCond::NE:
-            if (diff == 0) goto next_node;
-            break;
-          case SelCond::GT:
-            if (diff <= 0) goto next_node;
-            break;
-          case SelCond::LT:
-            if (diff >= 0) goto next_node;
-            break;
-          case SelCond::GE:
-            if (diff < 0) goto next_node;
-            break;
-          case SelCond::LE:
-            if (diff > 0) goto next_node;
-            break;
+        count++;
 
-        }
+        // print the tuple (nothing for COUNT(*))
+        if (attr != 4) out.row(attr, key, value.c_str());
       }
+    }
+  }
 
-      count++;
-
-      switch (attr) {
-        case 1:  // SELECT key
-          fprintf(stdout, "%d\n", key);
-          break;
-        case 2:  // SELECT value
-          fprintf(stdout, "%s\n", value.c_str());
-          break;
-        case 3:  // SELECT *
-          fprintf(stdout, "%d '%s'\n", key, value.c_str());
-          break;
-      }
+  else if (plan.method == QueryPlan::BITMAP_SCAN)
+  {
+    if ((rc = bitmapScan(attr, pred, rf, index, count)) < 0) {
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      goto exit_select;
+    }
+  }
 
-      // next node
-      next_node:;
+  else if (plan.workers > 1)
+  {
+    // split the heap scan among threads
+    if ((rc = ParallelScan::run(attr, pred, rf, plan.workers, count)) < 0) {
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      goto exit_select;
     }
   }
 
   else
   {
-    // scan the table file from the beginning
+    // scan the table file from the beginning, a vector of records at a time
+    RecordBatch batch;
+    unsigned long long selected[RecordBatch::CAPACITY / 64];
+
     rid.pid = rid.sid = 0;
 
-    while (rid < rf.endRid()) {
-      // read the tuple
-      if ((rc = rf.read(rid, key, value)) < 0) {
+    while (true) {
+      if ((rc = rf.readBatch(rid, batch)) < 0) {
         fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
         goto exit_select;
       }
-
-      // check the conditions on the tuple
-      for (unsigned i = 0; i < cond.size(); i++) {
-        // compute the difference between the tuple value and the condition value
-        switch (cond[i].attr) {
-        case 1:
-  	diff = key - atoi(cond[i].value);
-  	break;
-        case 2:
-  	diff = strcmp(value.c_str(), cond[i].value);
-  	break;
+      if (batch.count == 0) break;
+
+      // evaluate the conditions on the whole batch
+      int matched = pred.filter(batch, selected);
+      count += matched;
+      if (attr == 4 || matched == 0) continue;
+
+      // print the selected tuples straight from their pages
+      for (int w = 0; w * 64 < batch.count; w++) {
+        for (unsigned long long bits = selected[w]; bits != 0; bits &= bits - 1) {
+          int i = w * 64 + __builtin_ctzll(bits);
+          out.row(attr, batch.keys[i], batch.values[i]);
         }
-
-        // skip the tuple if any condition is not met
-        switch (cond[i].comp) {
-        case SelCond::EQ:
-  	if (diff != 0) goto next_tuple;
-  	break;
-        case SelCond::NE:
-  	if (diff == 0) goto next_tuple;
-  	break;
-        case SelCond::GT:
-  	if (diff <= 0) goto next_tuple;
-  	break;
-        case SelCond::LT:
-  	if (diff >= 0) goto next_tuple;
-  	break;
-        case SelCond::GE:
-  	if (diff < 0) goto next_tuple;
-  	break;
-        case SelCond::LE:
-  	if (diff > 0) goto next_tuple;
-  	break;
-        }
-      }
-
-      // the condition is met for the tuple. 
-      // increase matching tuple counter
-      count++;
-
-      // print the tuple 
-      switch (attr) {
-      case 1:  // SELECT key
-        fprintf(stdout, "%d\n", key);
-        break;
-      case 2:  // SELECT value
-        fprintf(stdout, "%s\n", value.c_str());
-        break;
-      case 3:  // SELECT *
-        fprintf(stdout, "%d '%s'\n", key, value.c_str());
-        break;
       }
-
-      // move to the next tuple
-      next_tuple:
-      ++rid;
     }
   }
 
@@ -444,11 +425,14 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 
     // print matching tuple count if "select count(*)"
   if (attr == 4) {
-    fprintf(stdout, "%d\n", count);
+    out.count(count);
   }
+  out.flush();
   rc = 0;
 
-  if (need_index) index.close();
+  // the iterator keeps its leaf pinned until released
+  it.release();
+  if (plan.indexOpen()) index.close();
   rf.close();
   return rc;
 }
@@ -457,15 +441,13 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 {
   /* your code here */
   RecordFile rf;
-  RecordId rid;
-
   RC     rc;
-  int    key;     
-  string value;
-  ifstream file;
-  string line;
+  LoadFile file;
 
   BTreeIndex tree;
+  bool bulk = false;           // build the index bottom-up after loading
+  TableCatalog catalog;        // the statistics of the table
+  bool counted = true;         // false if the statistics are incomplete
 
   // open the table file
   if ((rc = rf.open(table + ".tbl", 'w')) < 0) 
@@ -474,43 +456,58 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
     return rc;
   }
 
+  // start from the statistics of the records already in the table;
+  // recompute them if the catalog is missing or out of date
+  if (catalog.read(table) < 0 || !catalog.matches(rf))
+  {
+    catalog = TableCatalog();
+    catalog.hasIndex = access((table + ".idx").c_str(), F_OK) == 0;
+    if ((rf.endRid().pid > 0 || rf.endRid().sid > 0) && catalog.collect(rf) < 0)
+    {
+      // keep no statistics rather than wrong ones: the planner then
+      // does without them until the next load that can read the table
+      fprintf(stderr, "Warning: could not read table %s to compute its statistics\n", table.c_str());
+      catalog = TableCatalog();
+      counted = false;
+      remove(TableCatalog::filename(table).c_str());
+    }
+  }
+
   // open the index file if necessary
   if (index && (rc = tree.open(table + ".idx", 'w')) < 0) 
   {
     fprintf(stderr, "Error opening or creating index for table %s\n", table.c_str());
+    rf.close();
     return rc;
   }
 
-  file.open(loadfile.c_str(), std::ifstream::in);
+  // an empty index is built in one pass once all tuples are stored
+  bulk = index && tree.empty();
 
-  while(!file.eof())
+  if ((rc = file.open(loadfile)) < 0)
   {
-    getline(file, line);
-
-    if (line == "")
-      break;
-
-    if (rc = parseLoadLine(line, key, value) < 0)
-    {
-      fprintf(stderr, "Error: could not parse line\n");
-      break;
-    }
-
-    if (rc = rf.append(key, value, rid) < 0)
-    {
-      fprintf(stderr, "Error: could not add to table\n");
-      break;
-    }
+    fprintf(stderr, "Error: could not open load file %s\n", loadfile.c_str());
+  }
+  else
+  {
+    // parse on the threads left over by the append and index stages
+    LoadPipeline pipeline(file, rf, catalog, index ? &tree : NULL, bulk, table);
+    rc = pipeline.run(max(1, ParallelScan::threads() - (index ? 2 : 1)));
+    pipeline.report(stderr);
+  }
 
-    if (index && (rc = tree.insert(key, rid)) < 0) 
+  // record the statistics of the table as loaded
+  if (counted && catalog.matches(rf))
+  {
+    catalog.setSize(rf);
+    catalog.hasIndex = catalog.hasIndex || index;
+    catalog.loadTime = time(NULL);
+    if (catalog.write(table) < 0)
     {
-      fprintf(stderr, "Error: could not add to index for table\n");
-      break;
+      fprintf(stderr, "Warning: could not write the catalog of table %s\n", table.c_str());
     }
   }
 
-  
-
   file.close();
   rf.close();
   tree.close();
@@ -518,43 +515,133 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
   return rc;
 }
 
-RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
+/*
+ * read the records of pages [first, last) of a table and sort their
+ * (key, RecordId) pairs. a slice of CREATE INDEX, run on a thread of its own.
+ */
+static void sortSlice(const RecordFile* rf, PageId first, PageId last, IndexSorter* sorter, RC* rc)
 {
-    const char *s;
-    char        c;
-    string::size_type loc;
-    
-    // ignore beginning white spaces
-    c = *(s = line.c_str());
-    while (c == ' ' || c == '\t') { c = *++s; }
-
-    // get the integer key value
-    key = atoi(s);
-
-    // look for comma
-    s = strchr(s, ',');
-    if (s == NULL) { return RC_INVALID_FILE_FORMAT; }
-
-    // ignore white spaces
-    do { c = *++s; } while (c == ' ' || c == '\t');
-    
-    // if there is nothing left, set the value to empty string
-    if (c == 0) { 
-        value.erase();
-        return 0;
+  RecordBatch batch;
+  RecordId rid = { first, 0 };
+  RecordId end = { last, 0 };
+  vector<IndexEntry> entries(RecordBatch::CAPACITY);
+
+  *rc = 0;
+  while ((*rc = rf->readBatch(rid, end, batch)) == 0 && batch.count > 0)
+  {
+    RecordId r = batch.first;
+    for (int i = 0; i < batch.count; i++, ++r)
+    {
+      entries[i].key = batch.keys[i];
+      entries[i].rid = r;
     }
+    if ((*rc = sorter->add(&entries[0], batch.count)) < 0) { return; }
+  }
+  batch.release();
 
-    // is the value field delimited by ' or "?
-    if (c == '\'' || c == '"') {
-        s++;
-    } else {
-        c = '\n';
+  if (*rc == 0) { *rc = sorter->finish(); }
+}
+
+RC SqlEngine::createIndex(const string& table)
+{
+  RecordFile rf;
+  RC     rc;
+  BTreeIndex tree;
+  TableCatalog catalog;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  // open the table file
+  if ((rc = rf.open(table + ".tbl", 'm')) < 0)
+  {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+  rf.advise(PageFile::SEQUENTIAL);
+
+  if ((rc = tree.open(table + ".idx", 'w')) < 0)
+  {
+    fprintf(stderr, "Error opening or creating index for table %s\n", table.c_str());
+    rf.close();
+    return rc;
+  }
+  if (!tree.empty())
+  {
+    fprintf(stderr, "Error: table %s already has an index\n", table.c_str());
+    tree.close();
+    rf.close();
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  // each thread reads a slice of consecutive pages in runs of
+  // PageFile::MAX_RANGE and sorts its entries in its share of the
+  // memory budget; the sorted slices are merged into the leaves
+  const RecordId& end = rf.endRid();
+  PageId pages = end.pid + (end.sid > 0);
+  int workers = ParallelScan::workersFor(pages);
+
+  vector<IndexSorter*> sorters;
+  vector<RC> rcs(workers);
+  vector<thread> threads;
+  for (int i = 0; i < workers; i++)
+  {
+    sorters.push_back(new IndexSorter(table + ".idx", IndexSorter::budget() / workers));
+    threads.push_back(thread(sortSlice, &rf, (PageId) ((long long) pages * i / workers),
+                             (PageId) ((long long) pages * (i + 1) / workers), sorters[i], &rcs[i]));
+  }
+  for (int i = 0; i < workers; i++) { threads[i].join(); }
+
+  for (int i = 0; i < workers && rc == 0; i++) { rc = rcs[i]; }
+  if (rc < 0)
+  {
+    fprintf(stderr, "Error: could not sort the index entries for table %s\n", table.c_str());
+  }
+  else
+  {
+    // the slices are in RecordId order, so equal keys stay in it
+    EntryMerge merge(vector<IndexEntrySource*>(sorters.begin(), sorters.end()));
+    if ((rc = tree.bulkLoad(merge)) < 0)
+    {
+      fprintf(stderr, "Error: could not build index for table %s\n", table.c_str());
     }
+  }
 
-    // get the value string
-    value.assign(s);
-    loc = value.find(c, 0);
-    if (loc != string::npos) { value.erase(loc); }
+  for (int i = 0; i < workers; i++) { delete sorters[i]; }
+  tree.close();
+
+  // do not leave a partial index behind
+  if (rc < 0)
+  {
+    remove((table + ".idx").c_str());
+    rf.close();
+    return rc;
+  }
+
+  int rows = (int) end.pid * RecordFile::RECORDS_PER_PAGE + end.sid;
+  fprintf(stderr, "  -- index: %d entries from %d pages by %d thread%s in %.2f s\n", rows, pages,
+          workers, (workers == 1) ? "" : "s",
+          chrono::duration<double>(chrono::steady_clock::now() - start).count());
+
+  // record the index in the statistics, if they are up to date
+  if (catalog.read(table) == 0 && catalog.matches(rf))
+  {
+    catalog.hasIndex = true;
+    if (catalog.write(table) < 0)
+    {
+      fprintf(stderr, "Warning: could not write the catalog of table %s\n", table.c_str());
+    }
+  }
+
+  rf.close();
+  return 0;
+}
+
+RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
+{
+    RC rc;
+    std::string_view v;
 
+    // parse the line up to the first NUL, as a C string
+    if ((rc = LoadFile::parseLine(line.c_str(), key, v)) < 0) { return rc; }
+    value.assign(v.data(), v.size());
     return 0;
 }
\ No newline at end of file
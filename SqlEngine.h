@@ -32,8 +32,9 @@ class SqlEngine {
     
   /**
    * takes the user commands from commandline and executes them.
-   * when user issues SELECT or LOAD from commandline, this function
-   * calls SqlEngine::select() or SqlEngine::load() functions.
+   * when user issues SELECT, LOAD or CREATE INDEX from commandline, this
+   * function calls SqlEngine::select(), SqlEngine::load() or
+   * SqlEngine::createIndex() functions.
    * @param commandline[IN] the input stream to get user commands
    * @return error code. 0 if no error
    */
@@ -60,6 +61,16 @@ class SqlEngine {
    */
   static RC load(const std::string& table, const std::string& loadfile, bool index);
 
+  /**
+   * build the index of a table from the records already in it.
+   * the table is scanned by several threads, each sorting the (key,
+   * RecordId) pairs of its part, and the index is built bottom-up from
+   * the merged pairs.
+   * @param table[IN] the table name in the CREATE INDEX command
+   * @return error code. 0 if no error
+   */
+  static RC createIndex(const std::string& table);
+
   /**
    * parse a line from the load file into the (key, value) pair.
    * @param line[IN] a line from a load file
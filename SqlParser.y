@@ -8,6 +8,7 @@
 #include "Bruinbase.h"
 #include "SqlEngine.h" 
 #include "PageFile.h"
+#include "ResultSink.h"
 
 int  sqllex(void);  
 void sqlerror(const char *str) { fprintf(stderr, "Error: %s\n", str); }
@@ -54,11 +55,12 @@ commands:
 	;
 
 command:
-        load_command { fprintf(stdout, "Bruinbase> "); }
-	| select_command { fprintf(stdout, "Bruinbase> "); }
+        load_command { ResultSink::get().prompt(); }
+	| index_command { ResultSink::get().prompt(); }
+	| select_command { ResultSink::get().prompt(); }
 	| quit_command
-	| error LF { fprintf(stdout, "Bruinbase> "); }
-	| LF { fprintf(stdout, "Bruinbase> "); }
+	| error LF { ResultSink::get().prompt(); }
+	| LF { ResultSink::get().prompt(); }
 	;
 
 quit_command:
@@ -78,6 +80,21 @@ load_command:
 	}
 	;
 
+index_command:
+	ID INDEX ID table LF {
+	  /* CREATE and ON are not keywords of the lexer, so that they
+	     remain usable as table names */
+	  if (strcasecmp($1, "create") == 0 && strcasecmp($3, "on") == 0) {
+	    SqlEngine::createIndex(std::string($4));
+	  } else {
+	    sqlerror("syntax error");
+	  }
+	  free($1);
+	  free($3);
+	  free($4);
+	}
+	;
+
 select_command:
 	SELECT attributes FROM table LF {
    	        std::vector<SelCond> conds;
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "TableCatalog.h"
+#include <cstdio>
+#include <cstring>
+
+using std::string;
+
+// the catalog file: CATALOG_MAGIC, CATALOG_VERSION and the fields in order
+static const int CATALOG_MAGIC = 0x54435442;   // "BTCT"
+static const int CATALOG_VERSION = 1;
+
+// the number of records before rid
+static int rowsBefore(const RecordId& rid)
+{
+  return rid.pid * RecordFile::RECORDS_PER_PAGE + rid.sid;
+}
+
+TableCatalog::TableCatalog()
+{
+  rows = 0;
+  pages = 0;
+  minKey = 0;
+  maxKey = 0;
+  hasIndex = false;
+  valueBytes = 0;
+  loadTime = 0;
+}
+
+RC TableCatalog::read(const string& table)
+{
+  FILE* f = fopen(filename(table).c_str(), "rb");
+  if (f == NULL) return RC_FILE_OPEN_FAILED;
+
+  int magic = 0, version = 0, index = 0;
+  long long when = 0;
+  bool ok = fread(&magic, sizeof(magic), 1, f) == 1 &&
+            fread(&version, sizeof(version), 1, f) == 1 &&
+            magic == CATALOG_MAGIC && version == CATALOG_VERSION &&
+            fread(&rows, sizeof(rows), 1, f) == 1 &&
+            fread(&pages, sizeof(pages), 1, f) == 1 &&
+            fread(&minKey, sizeof(minKey), 1, f) == 1 &&
+            fread(&maxKey, sizeof(maxKey), 1, f) == 1 &&
+            fread(&index, sizeof(index), 1, f) == 1 &&
+            fread(&valueBytes, sizeof(valueBytes), 1, f) == 1 &&
+            fread(&when, sizeof(when), 1, f) == 1;
+  fclose(f);
+
+  if (!ok) {
+    *this = TableCatalog();
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  hasIndex = index != 0;
+  loadTime = (time_t) when;
+  return 0;
+}
+
+RC TableCatalog::write(const string& table) const
+{
+  // write a new file and rename it over the old one, so that a failed
+  // write never leaves a half-written catalog behind
+  string name = filename(table);
+  string tmp = name + ".new";
+
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == NULL) return RC_FILE_OPEN_FAILED;
+
+  int magic = CATALOG_MAGIC, version = CATALOG_VERSION, index = hasIndex;
+  long long when = loadTime;
+  bool ok = fwrite(&magic, sizeof(magic), 1, f) == 1 &&
+            fwrite(&version, sizeof(version), 1, f) == 1 &&
+            fwrite(&rows, sizeof(rows), 1, f) == 1 &&
+            fwrite(&pages, sizeof(pages), 1, f) == 1 &&
+            fwrite(&minKey, sizeof(minKey), 1, f) == 1 &&
+            fwrite(&maxKey, sizeof(maxKey), 1, f) == 1 &&
+            fwrite(&index, sizeof(index), 1, f) == 1 &&
+            fwrite(&valueBytes, sizeof(valueBytes), 1, f) == 1 &&
+            fwrite(&when, sizeof(when), 1, f) == 1;
+  if (fclose(f) != 0) ok = false;
+
+  if (!ok || rename(tmp.c_str(), name.c_str()) != 0) {
+    remove(tmp.c_str());
+    return RC_FILE_WRITE_FAILED;
+  }
+  return 0;
+}
+
+RC TableCatalog::collect(const RecordFile& rf)
+{
+  RC rc;
+  RecordId rid;
+  RecordBatch batch;
+
+  rows = 0;
+  valueBytes = 0;
+
+  rid.pid = rid.sid = 0;
+  while ((rc = rf.readBatch(rid, batch)) == 0 && batch.count > 0) {
+    for (int i = 0; i < batch.count; i++) add(batch.keys[i], strlen(batch.values[i]));
+  }
+  if (rc < 0) return rc;
+
+  setSize(rf);
+  return 0;
+}
+
+void TableCatalog::setSize(const RecordFile& rf)
+{
+  const RecordId& end = rf.endRid();
+  rows = rowsBefore(end);
+  pages = end.pid + (end.sid > 0);
+}
+
+bool TableCatalog::matches(const RecordFile& rf) const
+{
+  return rows == rowsBefore(rf.endRid());
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef TABLECATALOG_H
+#define TABLECATALOG_H
+
+#include <ctime>
+#include <string>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+
+/**
+ * the statistics of a table, kept in the file <table>.cat next to its
+ * .tbl and .idx files. SqlEngine::load() updates the catalog after every
+ * load; SqlEngine::select() uses it to answer COUNT(*) and to skip key
+ * ranges outside [minKey, maxKey] without reading the table.
+ *
+ * the catalog describes the table as of its last load. it is only
+ * trusted while the table still has the row count it records (see
+ * matches()), so a table changed behind bruinbase's back is never
+ * answered from stale statistics.
+ */
+class TableCatalog {
+ public:
+  int    rows;         // # records in the table
+  int    pages;        // # pages of the table file
+  int    minKey;       // the smallest key (undefined if rows == 0)
+  int    maxKey;       // the largest key (undefined if rows == 0)
+  bool   hasIndex;     // true if the table has a B+tree index
+  long long valueBytes;  // the total length of the values
+  time_t loadTime;     // when the table was last loaded
+
+  TableCatalog();
+
+  /**
+   * @return the name of the catalog file of a table
+   */
+  static std::string filename(const std::string& table) { return table + ".cat"; }
+
+  /**
+   * read the catalog of a table.
+   * @param table[IN] the name of the table
+   * @return error code. 0 if no error. RC_FILE_OPEN_FAILED if the table
+   *         has no catalog.
+   */
+  RC read(const std::string& table);
+
+  /**
+   * write the catalog of a table.
+   * @param table[IN] the name of the table
+   * @return error code. 0 if no error
+   */
+  RC write(const std::string& table) const;
+
+  /**
+   * compute the statistics of a table by scanning all of its records.
+   * hasIndex and loadTime are left as they are.
+   * @param rf[IN] the table file
+   * @return error code. 0 if no error
+   */
+  RC collect(const RecordFile& rf);
+
+  /**
+   * add a record to the statistics.
+   * @param key[IN] the key of the record
+   * @param len[IN] the length of the value of the record
+   */
+  void add(int key, size_t len) {
+    if (rows == 0 || key < minKey) minKey = key;
+    if (rows == 0 || key > maxKey) maxKey = key;
+    rows++;
+    valueBytes += len;
+  }
+
+  /**
+   * set the row and page counts from the end of the table file.
+   * @param rf[IN] the table file
+   */
+  void setSize(const RecordFile& rf);
+
+  /**
+   * @return true if the catalog describes the table file as it is
+   */
+  bool matches(const RecordFile& rf) const;
+
+  /**
+   * @return the average length of a value
+   */
+  double avgValueLength() const { return rows == 0 ? 0 : (double) valueBytes / rows; }
+};
+
+#endif // TABLECATALOG_H
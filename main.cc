@@ -9,12 +9,83 @@
  
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "BufferPool.h"
+#include "BTreeNode.h"
+#include "ResultSink.h"
+#include "ParallelScan.h"
+#include "IndexSorter.h"
 #include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 
-int main()
+static void usage(const char* prog)
 {
+  fprintf(stderr, "usage: %s [-b buffer_pages] [-p clock|lru2|2q] [-t] [-s]\n"
+          "       [-k binary|sse|avx2] [-f text|tsv|binary] [-j threads] [-m sort_mb]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+  int  opt;
+  int  frames;
+  bool stats = false;
+  BufferPool::Policy policy;
+  BTKeySearch::Method search;
+  ResultSink::Format format;
+
+  // command-line flags override the BRUINBASE_BUFFER_* environment
+  // variables, each only for the setting it gives
+  BufferPool::configuration(frames, policy);
+  while ((opt = getopt(argc, argv, "b:p:tsk:f:j:m:")) != -1) {
+    switch (opt) {
+    case 'b':
+      if ((frames = atoi(optarg)) <= 0) usage(argv[0]);
+      break;
+    case 'p':
+      if (BufferPool::parsePolicy(optarg, policy) < 0) usage(argv[0]);
+      break;
+    case 't':
+      // write pages through to the disk instead of caching dirty pages
+      BufferPool::setWriteBack(false);
+      break;
+    case 's':
+      stats = true;
+      break;
+    case 'k':
+      // search B+tree nodes with the given method instead of the fastest
+      if (BTKeySearch::parseMethod(optarg, search) < 0) usage(argv[0]);
+      if (BTKeySearch::setMethod(search) < 0) {
+        fprintf(stderr, "%s: key search %s is not supported by this CPU\n", argv[0], optarg);
+        exit(1);
+      }
+      break;
+    case 'f':
+      // print query results in the given format for the whole session
+      if (ResultSink::parseFormat(optarg, format) < 0) usage(argv[0]);
+      ResultSink::get().setFormat(format);
+      break;
+    case 'j':
+      // scan tables with at most this many threads
+      if (atoi(optarg) <= 0) usage(argv[0]);
+      ParallelScan::setThreads(atoi(optarg));
+      break;
+    case 'm':
+      // sort the entries of an index built by LOAD in this much memory
+      if (atoi(optarg) <= 0) usage(argv[0]);
+      IndexSorter::setBudget(atoi(optarg));
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  BufferPool::configure(frames, policy);
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 
+  // print the buffer pool hit/miss counters of every file
+  if (stats) BufferPool::get().printStats(stderr);
+
   return 0;
 }